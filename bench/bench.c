@@ -0,0 +1,471 @@
+/*
+  bench.c - microbenchmarks for the learning loop hot path (make bench)
+  - each stage runs in isolation: features, forward, update, the environment (scalar and
+    batched), stm commits (MS_SYNC and MS_ASYNC), the config parse and the sidecar reads that
+    replaced it in the loop, an event log push against the snprintf it replaced, the rng one draw
+    at a time and in bulk, replayed updates from a full prioritized replay ring, minibatch
+    steps per optimizer, a GEMM_N cubed gemm (ops are flops), a forward and adam step of a
+    two-hidden-layer mlp, and a snapshot of the arena (SNAPSHOT=diff) and a restore from it, each
+    after one update dirtied the weights
+  - "loop" runs main()'s own loop step (loop.h) free: a batch refill every BATCH iterations, one
+    learn step and log push per iteration and a MS_SYNC commit every SYNC_INTERVAL, timed per
+    iteration so commits show in p99
+  - "loop_wal" is the same with SYNC_MODE=wal: a log record per iteration, an fdatasync of the
+    log every SYNC_INTERVAL and a commit every CHECKPOINT_INTERVAL; "wal_append" is one record
+    after one update
+  - a sample times 'reps' back-to-back calls, so the clock read is amortised for the cheap stages
+  - output is one row per stage as json (default) or csv, for diffing runs against each other
+  - --threads=N runs the mlp stages on a thread pool of N (deterministic reduction)
+  - usage: agi-bench [--format=json|csv] [--samples=N] [--features=N] [--threads=N]
+                     [--stm=PATH]
+*/
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "env.h"
+#include "evlog.h"
+#include "gemm.h"
+#include "loop.h"
+#include "mlp.h"
+#include "policy.h"
+#include "pool.h"
+#include "replay.h"
+#include "rng.h"
+#include "snapshot.h"
+#include "state.h"
+#include "stm.h"
+#include "vec.h"
+#include "wal.h"
+
+#define ENV_BATCH 256
+#define REPLAY_SAMPLES 4096
+#define REPLAY_MINIBATCH 32
+#define GEMM_N 64
+#define MLP_BENCH_WIDTH 64
+
+typedef struct {
+    const char* name;
+    uint64_t ops;       // operations timed, over every sample
+    double ns_per_op;   // mean
+    double p50, p99;    // per-op latency of a sample, ns
+    double ops_per_sec;
+} result_t;
+
+/* everything a stage may touch */
+typedef struct {
+    const policy_api_t* policy;
+    policy_ctx_t ctx;
+    stm_stats_t* stats;
+    double* phi;
+    env_batch_t env;
+    double* batch_phi; // a minibatch: REPLAY_MINIBATCH feature vectors and their rewards
+    const double* rows[REPLAY_MINIBATCH];
+    double rewards[REPLAY_MINIBATCH];
+    double* draws; // ENV_BATCH of them
+    double* gemm_abc; // three GEMM_N x GEMM_N matrices
+    policy_ctx_t mlp_ctx; // the same core with an mlp whose parameters live on the heap
+    stm_mlp_t mlp;
+    stm_optim_t mlp_optim;
+    double mlp_out[REPLAY_MINIBATCH];
+    loop_t loop; // the loop stages' batch, on ctx
+    config_t cfg;
+    const char* config_path;
+    const char* stm_path;
+    uint64_t i;
+    double sink; // results land here so the calls cannot be optimised away
+} bench_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* --- stages: one call does 'per_call' operations --- */
+static void stage_features(bench_t* b) {
+    b->policy->features((int)b->i, b->phi, b->ctx.core->n_features);
+}
+
+static void stage_forward(bench_t* b) {
+    b->sink += b->policy->forward(&b->ctx, b->phi);
+}
+
+static void stage_update(bench_t* b) {
+    b->policy->update(&b->ctx, b->phi, (b->i & 1) ? 1.0 : -1.0, b->cfg.learning_rate);
+}
+
+static void stage_reward(bench_t* b) {
+    b->sink += env_reward((int)b->i, (double)(b->i & 3) - 1.5);
+}
+
+static void stage_env_step(bench_t* b) {
+    env_step(&b->env);
+    b->sink += b->env.reward[b->i % ENV_BATCH];
+}
+
+static void stage_commit_sync(bench_t* b) {
+    b->ctx.core->iter++;
+    stm_commit(MS_SYNC);
+}
+
+static void stage_commit_async(bench_t* b) {
+    b->ctx.core->iter++;
+    stm_commit(MS_ASYNC);
+}
+
+static void stage_snapshot_take(bench_t* b) {
+    stage_update(b);
+    b->sink += snapshot_take(SNAPSHOT_DIFF, b->stm_path, &b->i, sizeof(b->i), NULL);
+}
+
+static void stage_snapshot_restore(bench_t* b) {
+    stage_update(b);
+    b->sink += snapshot_restore(b->stm_path, NULL);
+}
+
+static void stage_config(bench_t* b) {
+    config_t cfg = read_config_from_source(b->config_path);
+    b->sink += cfg.learning_rate;
+}
+
+static void stage_config_load(bench_t* b) {
+    config_t cfg = config_load(NULL);
+    b->sink += cfg.learning_rate;
+}
+
+static void stage_config_refresh(bench_t* b) {
+    config_refresh(b->config_path);
+}
+
+static void stage_log_push(bench_t* b) {
+    stm_core_t* core = b->ctx.core;
+    evlog_push(EV_TICK, b->i, b->ctx.weights[0], core->bias, core->running_reward, 1.0, 0);
+}
+
+static void stage_log_format(bench_t* b) {
+    stm_core_t* core = b->ctx.core;
+    snprintf(b->stats->scratch, sizeof(b->stats->scratch), "iter=%lu w0=%.6f b=%.6f rr=%.4f",
+             b->i, b->ctx.weights[0], core->bias, core->running_reward);
+}
+
+static void stage_rng_uniform(bench_t* b) {
+    b->sink += rng_uniform(rng_local());
+}
+
+static void stage_rng_fill(bench_t* b) {
+    rng_bulk_fill(rng_local_bulk(), b->draws, ENV_BATCH);
+    b->sink += b->draws[b->i % ENV_BATCH];
+}
+
+static void stage_replay_push(bench_t* b) {
+    replay_push(b->phi, (b->i & 1) ? 1.0 : -1.0, b->i);
+}
+
+static void stage_replay_train(bench_t* b) {
+    replay_train(b->policy, &b->ctx, rng_local_bulk(), REPLAY_PRIORITIZED, REPLAY_MINIBATCH,
+                 OPTIM_NLMS, 1, b->cfg.learning_rate);
+}
+
+static void train(bench_t* b, int optimizer) {
+    b->policy->train(&b->ctx, b->rows, b->rewards, NULL, REPLAY_MINIBATCH, optimizer,
+                     b->cfg.learning_rate);
+}
+
+static void stage_train_sgd(bench_t* b) {
+    train(b, OPTIM_SGD);
+}
+
+static void stage_train_momentum(bench_t* b) {
+    train(b, OPTIM_MOMENTUM);
+}
+
+static void stage_train_adam(bench_t* b) {
+    train(b, OPTIM_ADAM);
+}
+
+static void stage_gemm(bench_t* b) {
+    const double* a = b->gemm_abc;
+    const double* bm = a + GEMM_N * GEMM_N;
+    double* c = b->gemm_abc + 2 * GEMM_N * GEMM_N;
+    gemm(false, false, GEMM_N, GEMM_N, GEMM_N, 1.0, a, GEMM_N, bm, GEMM_N, 0.0, c, GEMM_N);
+    b->sink += c[b->i % (GEMM_N * GEMM_N)];
+}
+
+static void stage_mlp_forward(bench_t* b) {
+    b->policy->forward_batch(&b->mlp_ctx, b->batch_phi, REPLAY_MINIBATCH, b->mlp_out);
+    b->sink += b->mlp_out[0];
+}
+
+static void stage_mlp_train(bench_t* b) {
+    b->policy->train(&b->mlp_ctx, b->rows, b->rewards, NULL, REPLAY_MINIBATCH, OPTIM_ADAM,
+                     b->cfg.learning_rate);
+}
+
+/* one iteration of main()'s loop, without what it does only every so many (status, mutation) */
+static void loop_iteration(bench_t* b, const config_t* cfg) {
+    if (loop_drained(&b->loop) && !loop_refill(&b->loop, b->policy, b->ctx.core->iter))
+        exit(1);
+    loop_learn(&b->loop, b->policy, cfg);
+    b->ctx.core->iter++;
+    loop_commit(&b->loop, cfg);
+}
+
+/* with the default BATCH and SYNC_MODE=interval */
+static void stage_loop(bench_t* b) {
+    loop_iteration(b, &b->cfg);
+}
+
+static void stage_wal_append(bench_t* b) {
+    stage_update(b);
+    wal_append(b->i, 1.0, b->ctx.weights, b->ctx.core->n_features, b->ctx.core);
+}
+
+/* the same iteration with SYNC_MODE=wal */
+static void stage_loop_wal(bench_t* b) {
+    config_t cfg = b->cfg;
+    cfg.sync_mode = SYNC_WAL;
+    loop_iteration(b, &cfg);
+}
+
+static result_t run_stage(const char* name, void (*fn)(bench_t*), bench_t* b, size_t samples,
+                          size_t reps, size_t per_call) {
+    double* lat = malloc(samples * sizeof(double));
+    if (!lat) {
+        perror("malloc(samples)");
+        exit(1);
+    }
+    for (size_t r = 0; r < reps; r++, b->i++) // warm caches and branch predictors
+        fn(b);
+    uint64_t total = 0;
+    for (size_t s = 0; s < samples; s++) {
+        evlog_make_room(); // the loop's drain thread keeps up at any real tick rate
+        uint64_t t0 = now_ns();
+        for (size_t r = 0; r < reps; r++, b->i++)
+            fn(b);
+        uint64_t dt = now_ns() - t0;
+        total += dt;
+        lat[s] = (double)dt / (double)(reps * per_call);
+    }
+    qsort(lat, samples, sizeof(double), cmp_double);
+    result_t res = {name, (uint64_t)(samples * reps * per_call), 0, 0, 0, 0};
+    res.ns_per_op = (double)total / (double)res.ops;
+    res.p50 = lat[samples / 2];
+    res.p99 = lat[(samples * 99) / 100];
+    res.ops_per_sec = res.ns_per_op > 0 ? 1e9 / res.ns_per_op : 0;
+    free(lat);
+    return res;
+}
+
+static void print_results(const char* format, const bench_t* b, const result_t* res, size_t n) {
+    if (strcmp(format, "csv") == 0) {
+        printf("stage,ops,ns_per_op,p50_ns,p99_ns,ops_per_sec\n");
+        for (size_t i = 0; i < n; i++)
+            printf("%s,%lu,%.2f,%.2f,%.2f,%.0f\n", res[i].name, res[i].ops, res[i].ns_per_op,
+                   res[i].p50, res[i].p99, res[i].ops_per_sec);
+        return;
+    }
+    printf("{\"vec\": \"%s\", \"env\": \"%s\", \"rng\": \"%s\", \"features\": %lu, "
+           "\"threads\": %zu, \"stages\": [\n",
+           vec->name, env_kernel(), rng_kernel(), b->ctx.core->n_features, b->mlp_ctx.threads);
+    for (size_t i = 0; i < n; i++)
+        printf("  {\"stage\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.2f, \"p50_ns\": %.2f, "
+               "\"p99_ns\": %.2f, \"ops_per_sec\": %.0f}%s\n",
+               res[i].name, res[i].ops, res[i].ns_per_op, res[i].p50, res[i].p99,
+               res[i].ops_per_sec, i + 1 < n ? "," : "");
+    printf("]}\n");
+}
+
+int main(int argc, char** argv) {
+    const char* format = "json";
+    const char* stm_path = "build/bench.stm";
+    const char* config_bin_path = "build/bench-config.bin";
+    const char* wal_path = "build/bench.wal";
+    size_t samples = 2000;
+    long features = 64;
+    long threads = 1;
+    for (int i = 1; i < argc; i++) {
+        const char* v;
+        if ((v = config_value(argv[i], "--format=")) &&
+            (strcmp(v, "json") == 0 || strcmp(v, "csv") == 0)) {
+            format = v;
+        } else if ((v = config_value(argv[i], "--samples=")) && atol(v) > 0) {
+            samples = (size_t)atol(v);
+        } else if ((v = config_value(argv[i], "--features=")) && atol(v) > 0) {
+            features = atol(v);
+        } else if ((v = config_value(argv[i], "--threads=")) && atol(v) > 0) {
+            threads = atol(v);
+        } else if ((v = config_value(argv[i], "--stm="))) {
+            stm_path = v;
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--format=json|csv] [--samples=N] [--features=N] [--threads=N] "
+                    "[--stm=PATH]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    vec_init();
+    env_init();
+    gemm_init();
+    rng_init(1, 0);
+    unlink(stm_path);
+    if (stm_open(stm_path) != STM_FRESH || !stm_reserve("core", sizeof(stm_core_t), STM_DURABLE) ||
+        !stm_reserve("weights", (uint64_t)features * sizeof(double), STM_DURABLE) ||
+        !stm_reserve("stats", sizeof(stm_stats_t), 0) ||
+        !stm_reserve("optim", sizeof(stm_optim_t), STM_DURABLE) ||
+        !stm_reserve("optim_m", (uint64_t)features * sizeof(double), STM_DURABLE) ||
+        !stm_reserve("optim_v", (uint64_t)features * sizeof(double), STM_DURABLE) ||
+        !stm_reserve("wal", sizeof(stm_wal_t), STM_DURABLE) ||
+        !replay_bind(REPLAY_SAMPLES, (uint64_t)features))
+        return 1;
+
+    bench_t b = {0};
+    b.policy = agi_policy();
+    b.ctx.core = stm_section("core", NULL);
+    b.ctx.weights = stm_section("weights", NULL);
+    b.ctx.vec = vec;
+    b.ctx.optim = stm_section("optim", NULL);
+    b.ctx.optim_m = stm_section("optim_m", NULL);
+    b.ctx.optim_v = stm_section("optim_v", NULL);
+    b.ctx.grad = calloc((size_t)features + 1, sizeof(double));
+    b.ctx.threads = 1;
+    b.ctx.core->n_features = (uint64_t)features;
+    b.ctx.weights[0] = 0.1;
+    b.stats = stm_section("stats", NULL);
+    b.cfg = config_defaults;
+    b.cfg.sync_mode = SYNC_INTERVAL;
+    b.config_path = "src/main.c";
+    b.stm_path = stm_path;
+    unlink(config_bin_path);
+    if (!config_bin_open(config_bin_path, b.config_path))
+        return 1;
+    b.phi = calloc((size_t)features, sizeof(double));
+    b.draws = calloc(ENV_BATCH, sizeof(double));
+    if (!b.phi || !b.draws || !b.ctx.grad || !env_batch_init(&b.env, ENV_BATCH) ||
+        !loop_init(&b.loop, &b.ctx, (size_t)b.cfg.batch))
+        return 1;
+    b.batch_phi = calloc(REPLAY_MINIBATCH * (size_t)features, sizeof(double));
+    if (!b.batch_phi)
+        return 1;
+    for (size_t j = 0; j < REPLAY_MINIBATCH; j++) {
+        b.rows[j] = b.batch_phi + j * (size_t)features;
+        b.policy->features((int)j, b.batch_phi + j * (size_t)features, (size_t)features);
+        b.rewards[j] = env_reward((int)j, 1.0);
+    }
+    b.gemm_abc = calloc(3 * GEMM_N * GEMM_N, sizeof(double));
+    if (!b.gemm_abc)
+        return 1;
+    for (size_t j = 0; j < 2 * GEMM_N * GEMM_N; j++)
+        b.gemm_abc[j] = rng_uniform(rng_local()) - 0.5;
+    b.mlp = (stm_mlp_t){.n_hidden = 2,
+                        .n_inputs = (uint64_t)features,
+                        .width = {MLP_BENCH_WIDTH, MLP_BENCH_WIDTH},
+                        .activation = MLP_RELU};
+    b.mlp.n_params = mlp_param_count(&b.mlp);
+    size_t np = (size_t)b.mlp.n_params;
+    b.mlp_ctx = b.ctx;
+    b.mlp_ctx.mlp = &b.mlp;
+    b.mlp_ctx.gemm = gemm;
+    b.mlp_ctx.optim = &b.mlp_optim;
+    b.mlp_ctx.weights = calloc(np, sizeof(double));
+    b.mlp_ctx.optim_m = calloc(np, sizeof(double));
+    b.mlp_ctx.optim_v = calloc(np, sizeof(double));
+    if (!pool_start((size_t)threads))
+        return 1;
+    b.mlp_ctx.parallel = pool_run;
+    b.mlp_ctx.threads = pool_threads();
+    b.mlp_ctx.deterministic = true;
+    b.mlp_ctx.grad = calloc(b.mlp_ctx.threads * (np + 1), sizeof(double));
+    b.mlp_ctx.work = calloc(b.mlp_ctx.threads * mlp_work_size(&b.mlp), sizeof(double));
+    if (!b.mlp_ctx.weights || !b.mlp_ctx.optim_m || !b.mlp_ctx.optim_v || !b.mlp_ctx.grad ||
+        !b.mlp_ctx.work)
+        return 1;
+    rng_bulk_fill(rng_local_bulk(), b.mlp_ctx.weights, b.mlp.n_params);
+    mlp_init_params(&b.mlp, b.mlp_ctx.weights);
+    b.env.n = ENV_BATCH;
+    for (size_t j = 0; j < ENV_BATCH; j++) {
+        b.env.iter[j] = (int32_t)j;
+        b.env.action[j] = (double)(j % 7) - 3.0;
+    }
+    unlink(wal_path);
+    if (wal_open(wal_path, true, b.ctx.weights, (uint64_t)features, b.ctx.core) < 0)
+        return 1;
+    stm_commit(MS_SYNC);
+    // a text log drains only the rare events to stderr, so the ticks cost just the push
+    if (!evlog_start(EVLOG_TEXT))
+        return 1;
+
+    // disk-bound stages get fewer samples so a run stays in the seconds
+    size_t slow = samples / 10 ? samples / 10 : 1;
+    result_t res[] = {
+            run_stage("features", stage_features, &b, samples, 64, 1),
+            run_stage("forward", stage_forward, &b, samples, 64, 1),
+            run_stage("update", stage_update, &b, samples, 64, 1),
+            run_stage("reward", stage_reward, &b, samples, 256, 1),
+            run_stage("env_step", stage_env_step, &b, samples, 4, ENV_BATCH),
+            run_stage("commit_sync", stage_commit_sync, &b, slow, 1, 1),
+            run_stage("commit_async", stage_commit_async, &b, samples, 1, 1),
+            run_stage("snapshot_take", stage_snapshot_take, &b, slow, 1, 1),
+            run_stage("snapshot_restore", stage_snapshot_restore, &b, samples, 1, 1),
+            run_stage("wal_append", stage_wal_append, &b, samples, 64, 1),
+            run_stage("config_parse", stage_config, &b, slow, 1, 1),
+            run_stage("config_load", stage_config_load, &b, samples, 64, 1),
+            run_stage("config_refresh", stage_config_refresh, &b, samples, 4, 1),
+            run_stage("rng_uniform", stage_rng_uniform, &b, samples, 256, 1),
+            run_stage("rng_fill", stage_rng_fill, &b, samples, 4, ENV_BATCH),
+            run_stage("replay_push", stage_replay_push, &b, samples, 64, 1),
+            run_stage("replay_train", stage_replay_train, &b, samples, 4, REPLAY_MINIBATCH),
+            run_stage("train_sgd", stage_train_sgd, &b, samples, 4, REPLAY_MINIBATCH),
+            run_stage("train_momentum", stage_train_momentum, &b, samples, 4, REPLAY_MINIBATCH),
+            run_stage("train_adam", stage_train_adam, &b, samples, 4, REPLAY_MINIBATCH),
+            run_stage("gemm", stage_gemm, &b, samples, 1, 2 * GEMM_N * GEMM_N * GEMM_N),
+            run_stage("mlp_forward", stage_mlp_forward, &b, samples, 4, REPLAY_MINIBATCH),
+            run_stage("mlp_train", stage_mlp_train, &b, samples, 1, REPLAY_MINIBATCH),
+            run_stage("log_push", stage_log_push, &b, samples, 64, 1),
+            run_stage("log_format", stage_log_format, &b, samples, 64, 1),
+            run_stage("loop", stage_loop, &b, samples * 10, 1, 1),
+            run_stage("loop_wal", stage_loop_wal, &b, samples * 10, 1, 1),
+    };
+    if (b.sink == 12345.678) // never true; keeps 'sink' observable
+        fprintf(stderr, "\n");
+    evlog_stop();
+    pool_stop();
+    print_results(format, &b, res, sizeof(res) / sizeof(res[0]));
+
+    env_batch_free(&b.env);
+    loop_free(&b.loop);
+    free(b.phi);
+    free(b.draws);
+    free(b.ctx.grad);
+    free(b.batch_phi);
+    free(b.gemm_abc);
+    free(b.mlp_ctx.weights);
+    free(b.mlp_ctx.optim_m);
+    free(b.mlp_ctx.optim_v);
+    free(b.mlp_ctx.grad);
+    free(b.mlp_ctx.work);
+    wal_close();
+    unlink(wal_path);
+    stm_close();
+    snapshot_drop(stm_path);
+    char snap[4096];
+    snprintf(snap, sizeof(snap), "%s.snap", stm_path);
+    unlink(snap);
+    unlink(stm_path);
+    config_bin_close();
+    unlink(config_bin_path);
+    return 0;
+}
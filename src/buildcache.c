@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+#include "buildcache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "stm.h"
+
+#define CACHE_DIR "build/cache"
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+
+static int cmp_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool is_source(const char* name) {
+    size_t n = strlen(name);
+    return n > 2 && name[n - 2] == '.' && (name[n - 1] == 'c' || name[n - 1] == 'h');
+}
+
+static uint64_t hash_source(uint64_t h, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return h;
+    char line[512];
+    bool in_block = false;
+    while (fgets(line, sizeof(line), f)) {
+        if (!in_block && strncmp(line, CONFIG_BEGIN, strlen(CONFIG_BEGIN)) == 0) {
+            in_block = true;
+            continue;
+        }
+        if (in_block) {
+            in_block = strstr(line, CONFIG_END) == NULL;
+            continue;
+        }
+        h = stm_hash(h, line, strlen(line));
+    }
+    fclose(f);
+    return h;
+}
+
+bool build_key(const char* src_dir, const char* profile, char key[BUILD_KEY_LEN]) {
+    DIR* d = opendir(src_dir);
+    if (!d)
+        return false;
+    char** names = NULL;
+    size_t n = 0;
+    struct dirent* e;
+    while ((e = readdir(d))) {
+        if (!is_source(e->d_name))
+            continue;
+        char** grown = realloc(names, (n + 1) * sizeof(*names));
+        if (!grown)
+            break;
+        names = grown;
+        names[n++] = strdup(e->d_name);
+    }
+    closedir(d);
+    qsort(names, n, sizeof(*names), cmp_names);
+
+    uint64_t h = stm_hash(FNV_OFFSET, AGI_BUILD_FLAGS, strlen(AGI_BUILD_FLAGS));
+    h = stm_hash(h, profile, strlen(profile) + 1);
+    for (size_t i = 0; i < n; i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", src_dir, names[i]);
+        h = stm_hash(h, names[i], strlen(names[i]) + 1);
+        h = hash_source(h, path);
+        free(names[i]);
+    }
+    free(names);
+    snprintf(key, BUILD_KEY_LEN, "%016" PRIx64, h);
+    return true;
+}
+
+bool build_copy_file(const char* from, const char* to) {
+    int in = open(from, O_RDONLY);
+    if (in < 0)
+        return false;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+    char buf[65536];
+    ssize_t n;
+    bool ok = true;
+    while (ok && (n = read(in, buf, sizeof(buf))) > 0)
+        ok = write(out, buf, (size_t)n) == n;
+    close(in);
+    close(out);
+    return ok && n == 0;
+}
+
+bool build_cache_lookup(const char* key, const char* artifact, char* path, size_t len) {
+    snprintf(path, len, "%s/%s/%s", CACHE_DIR, key, artifact);
+    return access(path, R_OK) == 0;
+}
+
+bool build_cache_store(const char* key, const char* built_path) {
+    char dir[4096], tmp[4096], dest[4096];
+    const char* base = strrchr(built_path, '/');
+    base = base ? base + 1 : built_path;
+    mkdir("build", 0755);
+    mkdir(CACHE_DIR, 0755);
+    snprintf(dir, sizeof(dir), "%s/%s", CACHE_DIR, key);
+    mkdir(dir, 0755);
+    snprintf(dest, sizeof(dest), "%s/%s/%s", CACHE_DIR, key, base);
+    snprintf(tmp, sizeof(tmp), "%s/%s/%s.tmp.%d", CACHE_DIR, key, base, (int)getpid());
+
+    bool ok = build_copy_file(built_path, tmp);
+    // entries are immutable once renamed into place, so readers never see a partial file
+    if (!ok || rename(tmp, dest) != 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
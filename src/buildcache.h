@@ -0,0 +1,29 @@
+/*
+  buildcache.h - content-addressed cache of self-built artifacts
+  - the key hashes every source under src/ with the config block blanked out, plus the build
+    flags and the Makefile profile it is built with, so a mutation that only touches the config
+    block maps onto the build already running
+  - artifacts live in build/cache/<key>/ and are reused instead of compiling again
+*/
+#ifndef AGI_BUILDCACHE_H
+#define AGI_BUILDCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BUILD_KEY_LEN 17 // 16 hex digits + NUL
+
+/* baked in by the Makefile */
+#ifndef AGI_BUILD_FLAGS
+#define AGI_BUILD_FLAGS ""
+#endif
+
+bool build_key(const char* src_dir, const char* profile, char key[BUILD_KEY_LEN]);
+/* path of 'artifact' (a basename) for 'key' in the cache, true if it exists */
+bool build_cache_lookup(const char* key, const char* artifact, char* path, size_t len);
+/* plain file copy, executable so it works for binaries and shared objects alike */
+bool build_copy_file(const char* from, const char* to);
+/* copy a freshly built file into the cache under 'key' */
+bool build_cache_store(const char* key, const char* built_path);
+
+#endif
@@ -0,0 +1,602 @@
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "evlog.h"
+#include "mlp.h"
+#include "pool.h"
+#include "replay.h"
+#include "rng.h"
+#include "snapshot.h"
+#include "stm.h"
+#include "tick.h"
+
+const char* const sync_mode_names[SYNC_MODE_COUNT] = {"always", "interval", "time", "async",
+                                                      "wal"};
+const char* const reload_mode_names[RELOAD_MODE_COUNT] = {"dlopen", "exec"};
+const char* const build_profile_names[BUILD_PROFILE_COUNT] = {"debug", "release", "pgo-gen",
+                                                              "pgo-use"};
+const char* const build_link_names[BUILD_LINK_COUNT] = {"dynamic", "static"};
+
+const char* const optimizer_names[OPTIMIZER_NAME_COUNT] = {"nlms", "sgd", "momentum", "adam"};
+_Static_assert(OPTIMIZER_NAME_COUNT == OPTIMIZER_COUNT, "one name per optimizer_t");
+
+const config_t config_defaults = {
+        0.05, 0.5, 10, SYNC_INTERVAL, 100, 1000, TICK_FIXED, 10.0, 64, RELOAD_DLOPEN, 1, 200, 1,
+        PROFILE_RELEASE, EVLOG_TEXT, 0, 0, 32, REPLAY_PRIORITIZED, OPTIM_NLMS, 1, 0, {0}, MLP_RELU,
+        1, true, 1, SNAPSHOT_AUTO, 10000, STM_HUGE_OFF, false, false, LINK_DYNAMIC, 0, false,
+};
+
+const char* config_value(const char* line, const char* key) {
+    size_t n = strlen(key);
+    return strncmp(line, key, n) == 0 ? line + n : NULL;
+}
+
+int parse_mode_name(const char* s, const char* const* names, int count) {
+    for (int i = 0; i < count; i++) {
+        size_t n = strlen(names[i]);
+        if (strncmp(s, names[i], n) == 0 && (s[n] == '\0' || s[n] == '\n' || s[n] == ' '))
+            return i;
+    }
+    return -1;
+}
+
+bool parse_config_line(const char* line, config_t* cfg) {
+    const char* v;
+    if ((v = config_value(line, "LEARNING_RATE="))) {
+        cfg->learning_rate = atof(v);
+        return true;
+    } else if ((v = config_value(line, "MUTATION_PROB="))) {
+        cfg->mutation_prob = atof(v);
+        return true;
+    } else if ((v = config_value(line, "RECOMPILE_INTERVAL="))) {
+        cfg->recompile_interval = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "SYNC_MODE="))) {
+        int mode = parse_mode_name(v, sync_mode_names, SYNC_MODE_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->sync_mode = mode;
+        return true;
+    } else if ((v = config_value(line, "SYNC_INTERVAL="))) {
+        cfg->sync_interval = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "SYNC_BUDGET_MS="))) {
+        cfg->sync_budget_ms = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "TICK_MODE="))) {
+        int mode = parse_mode_name(v, tick_mode_names, TICK_MODE_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->tick_mode = mode;
+        return true;
+    } else if ((v = config_value(line, "TICK_HZ="))) {
+        cfg->tick_hz = atof(v);
+        return true;
+    } else if ((v = config_value(line, "FEATURES="))) {
+        cfg->features = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "RELOAD_MODE="))) {
+        int mode = parse_mode_name(v, reload_mode_names, RELOAD_MODE_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->reload_mode = mode;
+        return true;
+    } else if ((v = config_value(line, "POPULATION="))) {
+        cfg->population = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "EVAL_WINDOW="))) {
+        cfg->eval_window = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "BATCH="))) {
+        cfg->batch = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "BUILD_PROFILE="))) {
+        int profile = parse_mode_name(v, build_profile_names, BUILD_PROFILE_COUNT);
+        if (profile < 0)
+            return false;
+        cfg->build_profile = profile;
+        return true;
+    } else if ((v = config_value(line, "EVLOG="))) {
+        int mode = parse_mode_name(v, evlog_mode_names, EVLOG_MODE_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->evlog = mode;
+        return true;
+    } else if ((v = config_value(line, "SEED="))) {
+        cfg->seed = strtoull(v, NULL, 10);
+        return true;
+    } else if ((v = config_value(line, "REPLAY_CAPACITY="))) {
+        cfg->replay_capacity = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "REPLAY_BATCH="))) {
+        cfg->replay_batch = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "REPLAY_SAMPLING="))) {
+        int mode = parse_mode_name(v, replay_sampling_names, REPLAY_SAMPLING_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->replay_sampling = mode;
+        return true;
+    } else if ((v = config_value(line, "OPTIMIZER="))) {
+        int mode = parse_mode_name(v, optimizer_names, OPTIMIZER_NAME_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->optimizer = mode;
+        return true;
+    } else if ((v = config_value(line, "EPOCHS="))) {
+        cfg->epochs = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "MLP_HIDDEN="))) {
+        // comma separated widths, "0" for none
+        int layers = 0;
+        char* end;
+        for (long w = strtol(v, &end, 10); end != v; w = strtol(v, &end, 10)) {
+            if (w > 0 && layers < MLP_MAX_HIDDEN)
+                cfg->mlp_width[layers++] = (int)w;
+            v = *end == ',' ? end + 1 : end;
+        }
+        cfg->mlp_layers = layers;
+        return true;
+    } else if ((v = config_value(line, "MLP_ACTIVATION="))) {
+        int mode = parse_mode_name(v, mlp_activation_names, MLP_ACTIVATION_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->mlp_activation = mode;
+        return true;
+    } else if ((v = config_value(line, "THREADS="))) {
+        cfg->threads = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "DETERMINISTIC="))) {
+        cfg->deterministic = atoi(v) != 0;
+        return true;
+    } else if ((v = config_value(line, "WORKERS="))) {
+        cfg->workers = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "SNAPSHOT="))) {
+        int mode = parse_mode_name(v, snapshot_mode_names, SNAPSHOT_MODE_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->snapshot = mode;
+        return true;
+    } else if ((v = config_value(line, "CHECKPOINT_INTERVAL="))) {
+        cfg->checkpoint_interval = atoi(v);
+        return true;
+    } else if ((v = config_value(line, "STM_HUGEPAGES="))) {
+        int mode = parse_mode_name(v, stm_huge_names, STM_HUGE_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->stm_hugepages = mode;
+        return true;
+    } else if ((v = config_value(line, "STM_LOCK="))) {
+        cfg->stm_lock = atoi(v) != 0;
+        return true;
+    } else if ((v = config_value(line, "STM_PREFAULT="))) {
+        cfg->stm_prefault = atoi(v) != 0;
+        return true;
+    } else if ((v = config_value(line, "BUILD_LINK="))) {
+        int mode = parse_mode_name(v, build_link_names, BUILD_LINK_COUNT);
+        if (mode < 0)
+            return false;
+        cfg->build_link = mode;
+        return true;
+    }
+    return false;
+}
+
+void write_config_block(FILE* out, const config_t* cfg) {
+    fprintf(out, "LEARNING_RATE=%.6g\n", cfg->learning_rate);
+    fprintf(out, "MUTATION_PROB=%.6g\n", cfg->mutation_prob);
+    fprintf(out, "RECOMPILE_INTERVAL=%d\n", cfg->recompile_interval);
+    fprintf(out, "SYNC_MODE=%s\n", sync_mode_names[cfg->sync_mode]);
+    fprintf(out, "SYNC_INTERVAL=%d\n", cfg->sync_interval);
+    fprintf(out, "SYNC_BUDGET_MS=%d\n", cfg->sync_budget_ms);
+    fprintf(out, "TICK_MODE=%s\n", tick_mode_names[cfg->tick_mode]);
+    fprintf(out, "TICK_HZ=%g\n", cfg->tick_hz);
+    fprintf(out, "FEATURES=%d\n", cfg->features);
+    fprintf(out, "RELOAD_MODE=%s\n", reload_mode_names[cfg->reload_mode]);
+    fprintf(out, "POPULATION=%d\n", cfg->population);
+    fprintf(out, "EVAL_WINDOW=%d\n", cfg->eval_window);
+    fprintf(out, "BATCH=%d\n", cfg->batch);
+    fprintf(out, "BUILD_PROFILE=%s\n", build_profile_names[cfg->build_profile]);
+    fprintf(out, "EVLOG=%s\n", evlog_mode_names[cfg->evlog]);
+    fprintf(out, "SEED=%lu\n", cfg->seed);
+    fprintf(out, "REPLAY_CAPACITY=%d\n", cfg->replay_capacity);
+    fprintf(out, "REPLAY_BATCH=%d\n", cfg->replay_batch);
+    fprintf(out, "REPLAY_SAMPLING=%s\n", replay_sampling_names[cfg->replay_sampling]);
+    fprintf(out, "OPTIMIZER=%s\n", optimizer_names[cfg->optimizer]);
+    fprintf(out, "EPOCHS=%d\n", cfg->epochs);
+    fprintf(out, "MLP_HIDDEN=");
+    for (int l = 0; l < cfg->mlp_layers; l++)
+        fprintf(out, l ? ",%d" : "%d", cfg->mlp_width[l]);
+    fprintf(out, cfg->mlp_layers ? "\n" : "0\n");
+    fprintf(out, "MLP_ACTIVATION=%s\n", mlp_activation_names[cfg->mlp_activation]);
+    fprintf(out, "THREADS=%d\n", cfg->threads);
+    fprintf(out, "DETERMINISTIC=%d\n", cfg->deterministic ? 1 : 0);
+    fprintf(out, "WORKERS=%d\n", cfg->workers);
+    fprintf(out, "SNAPSHOT=%s\n", snapshot_mode_names[cfg->snapshot]);
+    fprintf(out, "CHECKPOINT_INTERVAL=%d\n", cfg->checkpoint_interval);
+    fprintf(out, "STM_HUGEPAGES=%s\n", stm_huge_names[cfg->stm_hugepages]);
+    fprintf(out, "STM_LOCK=%d\n", cfg->stm_lock ? 1 : 0);
+    fprintf(out, "STM_PREFAULT=%d\n", cfg->stm_prefault ? 1 : 0);
+    fprintf(out, "BUILD_LINK=%s\n", build_link_names[cfg->build_link]);
+}
+
+config_t read_config_from_source(const char* selfpath) {
+    config_t cfg = config_defaults;
+    FILE* f = fopen(selfpath, "r");
+    if (!f)
+        return cfg;
+    char line[512];
+    bool in_block = false;
+    while (fgets(line, sizeof(line), f)) {
+        if (!in_block && strncmp(line, CONFIG_BEGIN, strlen(CONFIG_BEGIN)) == 0) {
+            in_block = true;
+            continue;
+        }
+        if (in_block && strstr(line, CONFIG_END))
+            break;
+        if (in_block) {
+            // trim whitespace
+            char* s = line;
+            while (*s == ' ' || *s == '\t')
+                s++;
+            parse_config_line(s, &cfg);
+        }
+    }
+    fclose(f);
+    if (cfg.sync_interval <= 0)
+        cfg.sync_interval = config_defaults.sync_interval;
+    if (cfg.sync_budget_ms <= 0)
+        cfg.sync_budget_ms = config_defaults.sync_budget_ms;
+    if (cfg.features < 1)
+        cfg.features = config_defaults.features;
+    if (cfg.recompile_interval < 1)
+        cfg.recompile_interval = config_defaults.recompile_interval;
+    if (cfg.population < 1)
+        cfg.population = 1;
+    if (cfg.population > POPULATION_MAX)
+        cfg.population = POPULATION_MAX;
+    if (cfg.eval_window < 1)
+        cfg.eval_window = config_defaults.eval_window;
+    if (cfg.batch < 1)
+        cfg.batch = 1;
+    if (cfg.batch > BATCH_MAX)
+        cfg.batch = BATCH_MAX;
+    if (cfg.replay_capacity < 0)
+        cfg.replay_capacity = 0;
+    if (cfg.replay_capacity > (int)REPLAY_CAPACITY_MAX)
+        cfg.replay_capacity = (int)REPLAY_CAPACITY_MAX;
+    if (cfg.replay_batch < 1)
+        cfg.replay_batch = 1;
+    if (cfg.replay_batch > REPLAY_BATCH_MAX)
+        cfg.replay_batch = REPLAY_BATCH_MAX;
+    if (cfg.epochs < 1)
+        cfg.epochs = 1;
+    if (cfg.epochs > EPOCHS_MAX)
+        cfg.epochs = EPOCHS_MAX;
+    for (int l = 0; l < cfg.mlp_layers; l++) {
+        if (cfg.mlp_width[l] > MLP_WIDTH_MAX)
+            cfg.mlp_width[l] = MLP_WIDTH_MAX;
+    }
+    if (cfg.threads < 1)
+        cfg.threads = 1;
+    if (cfg.threads > POOL_THREADS_MAX)
+        cfg.threads = POOL_THREADS_MAX;
+    if (cfg.workers < 1)
+        cfg.workers = 1;
+    if (cfg.workers > WORKERS_MAX)
+        cfg.workers = WORKERS_MAX;
+    if (cfg.checkpoint_interval < 1)
+        cfg.checkpoint_interval = config_defaults.checkpoint_interval;
+    return cfg;
+}
+
+bool apply_cli_overrides(config_t* cfg, int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        const char* v;
+        if ((v = config_value(argv[i], "--tick-mode="))) {
+            int mode = parse_mode_name(v, tick_mode_names, TICK_MODE_COUNT);
+            if (mode < 0)
+                return false;
+            cfg->tick_mode = mode;
+        } else if ((v = config_value(argv[i], "--tick-hz="))) {
+            cfg->tick_hz = atof(v);
+        } else if ((v = config_value(argv[i], "--iterations="))) {
+            cfg->max_iterations = strtoull(v, NULL, 10);
+        } else if (strcmp(argv[i], "--no-mutate") == 0) {
+            cfg->no_mutate = true;
+        } else if (config_value(argv[i], "--source=")) {
+            continue; // taken by locate_source
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+config_t mutate_config(const config_t* cur) {
+    rng_t* r = rng_local();
+    double mutation_prob = cur->mutation_prob;
+    config_t next = *cur;
+    double lr = cur->learning_rate * (1.0 + (rng_uniform(r) - 0.5) * 0.5);
+    if (rng_uniform(r) < mutation_prob) {
+        lr = lr * (1.0 + (rng_uniform(r) - 0.5) * 0.5);
+        if (lr <= 0)
+            lr = 0.001;
+    }
+    next.learning_rate = lr;
+    if (rng_uniform(r) < mutation_prob) {
+        double step = (rng_uniform(r) - 0.5) * 0.2;
+        next.mutation_prob = fmin(0.99, fmax(0.01, cur->mutation_prob + step));
+    }
+    if (rng_uniform(r) < mutation_prob) {
+        int delta = (int)rng_below(r, 5) - 2;
+        next.recompile_interval = cur->recompile_interval + delta;
+        if (next.recompile_interval < 1)
+            next.recompile_interval = 1;
+    }
+    return next;
+}
+
+/* the whole file in one NUL-terminated buffer, NULL if it cannot be read */
+static char* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return NULL;
+    struct stat st;
+    char* text = NULL;
+    if (fstat(fileno(f), &st) == 0 && (text = malloc((size_t)st.st_size + 1))) {
+        *len = fread(text, 1, (size_t)st.st_size, f);
+        text[*len] = '\0';
+    }
+    fclose(f);
+    return text;
+}
+
+/* the config block in 'text': [*begin, *end) covers the marker lines and everything between */
+static bool find_block(const char* text, const char** begin, const char** end) {
+    const char* b = text;
+    while (b && strncmp(b, CONFIG_BEGIN, strlen(CONFIG_BEGIN)) != 0) {
+        b = strchr(b, '\n');
+        b = b ? b + 1 : NULL;
+    }
+    const char* e = b ? strstr(b, CONFIG_END) : NULL;
+    if (!e)
+        return false;
+    e = strchr(e, '\n');
+    *begin = b;
+    *end = e ? e + 1 : b + strlen(b);
+    return true;
+}
+
+bool write_source_config(const char* selfpath, const config_t* cfg) {
+    size_t len = 0;
+    char* text = read_file(selfpath, &len);
+    const char *begin, *end;
+    if (!text || !find_block(text, &begin, &end)) {
+        free(text);
+        return false;
+    }
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", selfpath, (int)getpid());
+    FILE* out = fopen(tmp_path, "w");
+    if (!out) {
+        free(text);
+        return false;
+    }
+    // everything around the block is copied verbatim
+    fwrite(text, 1, (size_t)(begin - text), out);
+    fputs(CONFIG_BEGIN "\n", out);
+    write_config_block(out, cfg);
+    fputs("  " CONFIG_END "\n", out);
+    fwrite(end, 1, len - (size_t)(end - text), out);
+    free(text);
+    bool ok = !ferror(out);
+    ok = fclose(out) == 0 && ok;
+    // atomically replace
+    if (!ok || rename(tmp_path, selfpath) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+bool mutate_source_config(const char* selfpath, const config_t* cur) {
+    config_t next = mutate_config(cur);
+    return write_source_config(selfpath, &next);
+}
+
+/* --- compiled sidecar --- */
+#define CONFIG_BIN_MAGIC 0xC0F1B1A5A61ULL
+#define CONFIG_BIN_VERSION 12 // bump whenever config_t changes
+
+typedef struct {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t record_size; // sizeof(config_t), a second guard against a stale layout
+    uint64_t generation;  // odd while a writer is mid-update (seqlock)
+    // identity of the source the record was compiled from
+    uint64_t src_ino, src_size, src_mtime_ns;
+    config_t cfg;
+} config_bin_t;
+
+static config_bin_t* config_bin = NULL;
+// one writer at a time per process: the loop publishes mutations, the watcher hand edits
+static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool source_identity(const char* selfpath, uint64_t id[3]) {
+    struct stat st;
+    if (stat(selfpath, &st) != 0)
+        return false;
+    id[0] = (uint64_t)st.st_ino;
+    id[1] = (uint64_t)st.st_size;
+    id[2] = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+    return true;
+}
+
+static bool same_source(const uint64_t id[3]) {
+    return config_bin->src_ino == id[0] && config_bin->src_size == id[1] &&
+           config_bin->src_mtime_ns == id[2];
+}
+
+bool config_bin_open(const char* path, const char* selfpath) {
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        perror("open(config.bin)");
+        return false;
+    }
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || (uint64_t)st.st_size != sizeof(config_bin_t);
+    if (fresh && ftruncate(fd, sizeof(config_bin_t)) != 0) {
+        perror("ftruncate(config.bin)");
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, sizeof(config_bin_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap(config.bin)");
+        return false;
+    }
+    config_bin = p;
+    uint64_t id[3];
+    if (!fresh && config_bin->magic == CONFIG_BIN_MAGIC &&
+        config_bin->version == CONFIG_BIN_VERSION && config_bin->record_size == sizeof(config_t) &&
+        (config_bin->generation & 1) == 0 && source_identity(selfpath, id) && same_source(id))
+        return true;
+    if (config_bin->magic != CONFIG_BIN_MAGIC) {
+        memset(config_bin, 0, sizeof(*config_bin));
+        config_bin->magic = CONFIG_BIN_MAGIC;
+    }
+    config_bin->version = CONFIG_BIN_VERSION;
+    config_bin->record_size = sizeof(config_t);
+    config_bin->generation &= ~(uint64_t)1; // a writer died mid-update
+    return config_compile(selfpath);
+}
+
+void config_bin_close(void) {
+    if (config_bin)
+        munmap(config_bin, sizeof(config_bin_t));
+    config_bin = NULL;
+}
+
+bool config_compile(const char* selfpath) {
+    uint64_t id[3] = {0, 0, 0};
+    source_identity(selfpath, id); // a missing source compiles to the defaults
+    config_t cfg = read_config_from_source(selfpath);
+    pthread_mutex_lock(&compile_lock);
+    uint64_t gen = __atomic_load_n(&config_bin->generation, __ATOMIC_RELAXED);
+    __atomic_store_n(&config_bin->generation, gen + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    config_bin->cfg = cfg;
+    config_bin->src_ino = id[0];
+    config_bin->src_size = id[1];
+    config_bin->src_mtime_ns = id[2];
+    __atomic_store_n(&config_bin->generation, gen + 2, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&compile_lock);
+    return msync(config_bin, sizeof(*config_bin), MS_ASYNC) == 0;
+}
+
+bool config_refresh(const char* selfpath) {
+    uint64_t id[3];
+    if (source_identity(selfpath, id) && same_source(id))
+        return true;
+    return config_compile(selfpath);
+}
+
+uint64_t config_generation(void) {
+    return __atomic_load_n(&config_bin->generation, __ATOMIC_ACQUIRE);
+}
+
+config_t config_load(uint64_t* generation) {
+    config_t cfg;
+    uint64_t before, after;
+    do {
+        before = __atomic_load_n(&config_bin->generation, __ATOMIC_ACQUIRE);
+        cfg = config_bin->cfg;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&config_bin->generation, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+    if (generation)
+        *generation = after;
+    return cfg;
+}
+
+/* --- source locator --- */
+
+/* the crc of cksum(1): polynomial 0x04c11db7, msb first, length appended, inverted */
+static uint32_t crc_table[256];
+
+static uint32_t cksum_update(uint32_t crc, const unsigned char* p, size_t n) {
+    if (!crc_table[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i << 24;
+            for (int k = 0; k < 8; k++)
+                c = (c & 0x80000000u) ? (c << 1) ^ 0x04c11db7u : c << 1;
+            crc_table[i] = c;
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+        crc = (crc << 8) ^ crc_table[(crc >> 24) ^ p[i]];
+    return crc;
+}
+
+bool source_cksum(const char* path, uint32_t* sum) {
+    size_t len = 0;
+    char* text = read_file(path, &len);
+    const char *begin, *end;
+    if (!text || !find_block(text, &begin, &end)) {
+        free(text);
+        return false;
+    }
+    uint32_t crc = cksum_update(0, (const unsigned char*)text, (size_t)(begin - text));
+    crc = cksum_update(crc, (const unsigned char*)end, len - (size_t)(end - text));
+    free(text);
+    for (size_t n = len - (size_t)(end - begin); n; n >>= 8) {
+        unsigned char b = (unsigned char)(n & 0xff);
+        crc = cksum_update(crc, &b, 1);
+    }
+    *sum = ~crc;
+    return true;
+}
+
+bool locate_source(int argc, char** argv, const char* baked_path, uint32_t baked_sum, char* path,
+                   size_t len) {
+    const char* cand[3] = {NULL, getenv("AGI_SOURCE"), baked_path};
+    for (int i = 1; i < argc; i++) {
+        const char* v = config_value(argv[i], "--source=");
+        if (v)
+            cand[0] = v;
+    }
+    const char* fallback = NULL;
+    for (int i = 0; i < 3; i++) {
+        uint32_t sum;
+        if (!cand[i] || !cand[i][0])
+            continue;
+        if (!source_cksum(cand[i], &sum)) {
+            fprintf(stderr, "[agi] %s: no config block, skipping\n", cand[i]);
+            continue;
+        }
+        if (!baked_sum || sum == baked_sum) {
+            snprintf(path, len, "%s", cand[i]);
+            return true;
+        }
+        if (!fallback)
+            fallback = cand[i];
+    }
+    if (!fallback)
+        return false;
+    fprintf(stderr, "[agi] %s does not match this build (cksum differs), using it anyway\n",
+            fallback);
+    snprintf(path, len, "%s", fallback);
+    return true;
+}
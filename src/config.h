@@ -0,0 +1,166 @@
+/*
+  config.h - the runtime config: the BEGIN_CONFIG block of the source, plus command line overrides
+  - every key is optional; a missing or unparsable one keeps its default
+  - keep parse_config_line and write_config_block in step whenever a key is added
+  - mutate_config/write_source_config are the self-modification half: a random neighbour of the
+    current config, written back into the block
+  - the loop never parses text: the block is compiled into config.bin, a fixed-layout record
+    mmapped next to stm.dat with a generation counter, and reloaded only when that changes
+*/
+#ifndef AGI_CONFIG_H
+#define AGI_CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "state.h"
+
+/* --- durability: when the live STM gets committed and flushed to disk --- */
+typedef enum {
+    SYNC_ALWAYS,   // MS_SYNC commit every iteration (the old behaviour)
+    SYNC_INTERVAL, // MS_SYNC commit every SYNC_INTERVAL iterations
+    SYNC_TIME,     // MS_SYNC commit once SYNC_BUDGET_MS has passed since the last one
+    SYNC_ASYNC,    // MS_ASYNC commit every SYNC_INTERVAL iterations, MS_SYNC on exit/exec
+    SYNC_WAL,      // a write-ahead log record every iteration, flushed every SYNC_INTERVAL;
+                   // MS_SYNC commit every CHECKPOINT_INTERVAL iterations (see wal.h)
+} sync_mode_t;
+
+#define SYNC_MODE_COUNT 5
+extern const char* const sync_mode_names[SYNC_MODE_COUNT];
+
+/* the config block proper: a line starting with CONFIG_BEGIN up to the line containing CONFIG_END.
+   the bare words also appear in comments and string literals */
+#define CONFIG_BEGIN "/* ===== BEGIN_CONFIG"
+#define CONFIG_END "===== END_CONFIG */"
+
+/* --- self-modification: how a rebuilt generation takes over --- */
+typedef enum {
+    RELOAD_DLOPEN, // rebuild the policy shared object and swap it in, the process lives on
+    RELOAD_EXEC,   // rebuild everything and exec the new binary
+} reload_mode_t;
+
+#define RELOAD_MODE_COUNT 2
+extern const char* const reload_mode_names[RELOAD_MODE_COUNT];
+
+/* --- the Makefile PROFILE a self-rebuild uses --- */
+typedef enum {
+    PROFILE_DEBUG,   // -O0 with ubsan traps
+    PROFILE_RELEASE, // -O3 -march=native with lto
+    PROFILE_PGO_GEN, // release, instrumented for profile collection
+    PROFILE_PGO_USE, // release, optimised with the profile from 'make pgo'
+} build_profile_t;
+
+#define BUILD_PROFILE_COUNT 4
+extern const char* const build_profile_names[BUILD_PROFILE_COUNT];
+
+/* --- the Makefile LINK a self-rebuild uses --- */
+typedef enum {
+    LINK_DYNAMIC, // the policy can be dlopen'd into the binary
+    LINK_STATIC,  // static and not position independent: nothing to load or relocate at exec,
+                  // but no dlopen either, so every rebuild restarts by exec
+} build_link_t;
+
+#define BUILD_LINK_COUNT 2
+extern const char* const build_link_names[BUILD_LINK_COUNT];
+/* indexed by optimizer_t, see policy.h */
+#define OPTIMIZER_NAME_COUNT 4
+extern const char* const optimizer_names[OPTIMIZER_NAME_COUNT];
+
+/* --- the parsed config block --- */
+typedef struct {
+    double learning_rate;
+    double mutation_prob;
+    int recompile_interval;
+    int sync_mode;
+    int sync_interval;
+    int sync_budget_ms;
+    int tick_mode;
+    double tick_hz;
+    int features;
+    int reload_mode;
+    int population;  // candidate configs evaluated per mutation, 1 = plain random walk
+    int eval_window; // iterations each candidate is scored over
+    int batch;       // environment steps evaluated together, see env.h
+    int build_profile;
+    int evlog;       // loop event log, see evlog.h
+    uint64_t seed;   // random seed, 0 = a fresh one every run (see rng.h)
+    int replay_capacity; // samples kept for experience replay, 0 = off (see replay.h)
+    int replay_batch;    // replayed updates per iteration
+    int replay_sampling;
+    int optimizer; // see optimizer_t in policy.h; nlms is the online rule
+    int epochs;    // passes over each minibatch
+    int mlp_layers; // hidden layers, 0 = the linear learner (see mlp.h)
+    int mlp_width[MLP_MAX_HIDDEN];
+    int mlp_activation;
+    int threads;        // pool threads, the loop's included (see pool.h)
+    bool deterministic; // sum gradient copies in a fixed order, whatever the scheduling
+    int workers;        // learner processes on the shared arena, the loop's included
+    int snapshot;       // how the arena is snapshotted before a mutation, see snapshot.h
+    int checkpoint_interval; // iterations between full commits with SYNC_MODE=wal
+    int stm_hugepages;       // huge pages for the arena mapping, see stm_huge_t in stm.h
+    bool stm_lock;           // mlock the live sections
+    bool stm_prefault;       // fault the whole arena in at startup and whenever it grows
+    int build_link;
+    // command line only, never written to the block
+    uint64_t max_iterations; // stop after this many iterations in this process, 0 = run forever
+    bool no_mutate;          // never mutate or rebuild (profiling and benchmark runs)
+} config_t;
+
+extern const config_t config_defaults;
+
+#define POPULATION_MAX 64
+#define BATCH_MAX 4096
+#define EPOCHS_MAX 64
+#define WORKERS_MAX 64
+
+/* returns the value part of the line if it starts with 'key', else NULL */
+const char* config_value(const char* line, const char* key);
+/* map a mode name onto its index in 'names', -1 if unknown */
+int parse_mode_name(const char* s, const char* const* names, int count);
+/* parse numeric value after 'KEY=' on a line, returns true if set */
+bool parse_config_line(const char* line, config_t* cfg);
+/* write the body of a config block (without the markers) */
+void write_config_block(FILE* out, const config_t* cfg);
+/* open this source file and find the config block, parse numbers */
+config_t read_config_from_source(const char* selfpath);
+/* command line overrides win over the config block; they are re-applied after every re-read and
+   survive exec because argv is passed along. returns false on an unknown argument */
+bool apply_cli_overrides(config_t* cfg, int argc, char** argv);
+
+/* a random neighbour of 'cur': tweaks learning rate, mutation prob and recompile interval, every
+   other key keeps its current value */
+config_t mutate_config(const config_t* cur);
+/* rewrite the config block of the source in place with 'cfg' */
+bool write_source_config(const char* selfpath, const config_t* cfg);
+/* mutate the config block in-place: random tweaks */
+bool mutate_source_config(const char* selfpath, const config_t* cur);
+
+/* --- source locator: the main.c that holds the config block and that make compiles --- */
+
+/* cksum(1) of 'path' with the config block lines dropped, false if it is unreadable or has no
+   block. matches: sed '/^\/\* ===== BEGIN_CONFIG/,/===== END_CONFIG \*\//d' | cksum */
+bool source_cksum(const char* path, uint32_t* sum);
+/* pick the source from --source=PATH, then $AGI_SOURCE, then 'baked_path' (set by the Makefile).
+   a candidate whose cksum is 'baked_sum' (0: unknown) wins, else the first one with a config
+   block is used with a warning. false if there is none */
+bool locate_source(int argc, char** argv, const char* baked_path, uint32_t baked_sum, char* path,
+                   size_t len);
+
+/* --- compiled sidecar --- */
+#define CONFIG_BIN_PATH "config.bin"
+
+/* map the sidecar, creating it if needed; compiles 'selfpath' into it unless it already holds
+   that exact source (same inode, size and mtime) */
+bool config_bin_open(const char* path, const char* selfpath);
+void config_bin_close(void);
+/* parse the block of 'selfpath' into the sidecar and publish it as a new generation */
+bool config_compile(const char* selfpath);
+/* recompile only if 'selfpath' changed since the last compile: a stat, no parsing */
+bool config_refresh(const char* selfpath);
+/* generation of the published config, a plain load; changes whenever the config does */
+uint64_t config_generation(void);
+/* consistent copy of the published config (command line overrides not applied) */
+config_t config_load(uint64_t* generation);
+
+#endif
@@ -0,0 +1,96 @@
+#include "env.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ENV_X86 1
+#include <immintrin.h>
+#endif
+
+#define ENV_ALIGN 64
+
+double env_reward(int iter, double action) {
+    int target = (iter % 10) < 5 ? 1 : -1;
+    int act = (action >= 0) ? 1 : -1;
+    return (act == target) ? 1.0 : -1.0;
+}
+
+/* --- portable fallback --- */
+static void step_scalar(env_batch_t* b) {
+    for (size_t i = 0; i < b->n; i++)
+        b->reward[i] = env_reward(b->iter[i], b->action[i]);
+}
+
+#ifdef ENV_X86
+/* --- avx2: four instances per step. iter % 10 as t - 10 * trunc(t / 10) in doubles, which is
+   exact for every int32 and truncates like C's % does for negative steps --- */
+__attribute__((target("avx2,fma"))) static void step_avx2(env_batch_t* b) {
+    const __m256d ten = _mm256_set1_pd(10.0), five = _mm256_set1_pd(5.0);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d hit = _mm256_set1_pd(1.0), miss = _mm256_set1_pd(-1.0);
+    size_t i = 0;
+    for (; i + 4 <= b->n; i += 4) {
+        __m256d t = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(b->iter + i)));
+        __m256d q = _mm256_round_pd(_mm256_div_pd(t, ten), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m256d phase = _mm256_fnmadd_pd(ten, q, t);
+        __m256d want = _mm256_cmp_pd(phase, five, _CMP_LT_OQ);
+        __m256d act = _mm256_cmp_pd(_mm256_loadu_pd(b->action + i), zero, _CMP_GE_OQ);
+        // lanes where the action's sign and the target disagree
+        __m256d wrong = _mm256_xor_pd(want, act);
+        _mm256_storeu_pd(b->reward + i, _mm256_blendv_pd(hit, miss, wrong));
+    }
+    for (; i < b->n; i++)
+        b->reward[i] = env_reward(b->iter[i], b->action[i]);
+    _mm256_zeroupper();
+}
+#endif
+
+static void (*step_kernel)(env_batch_t* b) = step_scalar;
+static const char* step_name = "scalar";
+
+void env_init(void) {
+    step_kernel = step_scalar;
+    step_name = "scalar";
+#ifdef ENV_X86
+    if (vec_has_avx2()) {
+        step_kernel = step_avx2;
+        step_name = "avx2";
+    }
+#endif
+}
+
+const char* env_kernel(void) {
+    return step_name;
+}
+
+static void* alloc_field(size_t cap, size_t elem) {
+    size_t bytes = (cap * elem + ENV_ALIGN - 1) & ~(size_t)(ENV_ALIGN - 1);
+    return aligned_alloc(ENV_ALIGN, bytes);
+}
+
+bool env_batch_init(env_batch_t* b, size_t cap) {
+    memset(b, 0, sizeof(*b));
+    b->iter = alloc_field(cap, sizeof(int32_t));
+    b->action = alloc_field(cap, sizeof(double));
+    b->reward = alloc_field(cap, sizeof(double));
+    if (!b->iter || !b->action || !b->reward) {
+        env_batch_free(b);
+        return false;
+    }
+    b->cap = cap;
+    return true;
+}
+
+void env_batch_free(env_batch_t* b) {
+    free(b->iter);
+    free(b->action);
+    free(b->reward);
+    memset(b, 0, sizeof(*b));
+}
+
+void env_step(env_batch_t* b) {
+    step_kernel(b);
+}
@@ -0,0 +1,36 @@
+/*
+  env.h - the toy environment, stepped B instances at a time
+  - the task: reward +1 if the sign of the action matches ((iter % 10) < 5), else -1
+  - a batch is structure-of-arrays (one 64-byte aligned buffer per field) so the reward kernel
+    runs through it with full-width loads and no gathers
+  - env_init() picks the kernel matching the selected vec set (call it after vec_init)
+*/
+#ifndef AGI_ENV_H
+#define AGI_ENV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    size_t n;   // live instances, at most cap
+    size_t cap;
+    int32_t* iter;  // in: the step each instance is at
+    double* action; // in: the learner's output for that step
+    double* reward; // out: filled by env_step
+} env_batch_t;
+
+void env_init(void);
+/* name of the selected reward kernel */
+const char* env_kernel(void);
+
+/* allocate room for 'cap' instances; n starts at 0 */
+bool env_batch_init(env_batch_t* b, size_t cap);
+void env_batch_free(env_batch_t* b);
+
+/* reward for a single (iter, action) pair */
+double env_reward(int iter, double action);
+/* fill b->reward[0..n) */
+void env_step(env_batch_t* b);
+
+#endif
@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include "evlog.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define EVLOG_MAGIC 0xE71B106ULL
+#define EVLOG_VERSION 1
+#define DRAIN_IDLE_NS 2000000 // poll period of an empty ring
+
+const char* const evlog_mode_names[EVLOG_MODE_COUNT] = {"off", "text", "raw"};
+
+_Static_assert(sizeof(evlog_record_t) == 64, "records are one cache line");
+_Static_assert((EVLOG_CAPACITY & (EVLOG_CAPACITY - 1)) == 0, "capacity is a power of two");
+
+typedef struct {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t record_size;
+} evlog_file_header_t;
+
+evlog_ring_t evlog_ring;
+
+static int drain_mode = EVLOG_OFF;
+static FILE* raw_out = NULL;
+static pthread_t drain;
+static bool drain_stop = false; // set by evlog_stop, read by the drain thread
+static uint64_t dropped_seen = 0;
+
+static void format_record(FILE* out, const evlog_record_t* e, bool ticks) {
+    switch (e->event) {
+        case EV_TICK:
+            if (ticks)
+                fprintf(out, "[agi] tick iter=%lu w0=%.6f b=%.6f rr=%.4f reward=%g\n", e->iter,
+                        e->w0, e->bias, e->running_reward, e->a);
+            break;
+        case EV_STATUS:
+            fprintf(out, "[agi] iter=%lu w0=%.6f b=%.6f rr=%.4f overruns=%.0f/%.0f\n", e->iter,
+                    e->w0, e->bias, e->running_reward, e->a, e->b);
+            break;
+        case EV_SKIP:
+            fprintf(out, "[agi] chose not to mutate this cycle (r=%.3f)\n", e->a);
+            break;
+        default:
+            fprintf(out, "[agi] unknown event %u at iter=%lu\n", e->event, e->iter);
+    }
+}
+
+/* consume everything currently in the ring, true if there was anything */
+static bool drain_once(void) {
+    evlog_ring_t* r = &evlog_ring;
+    uint64_t tail = r->tail;
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (tail == head)
+        return false;
+    for (; tail != head; tail++) {
+        const evlog_record_t* e = &r->slots[tail & (EVLOG_CAPACITY - 1)];
+        if (drain_mode == EVLOG_RAW)
+            fwrite(e, sizeof(*e), 1, raw_out);
+        else
+            format_record(stderr, e, false);
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    // the producer's counter, only ever reported late
+    uint64_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    if (dropped != dropped_seen) {
+        fprintf(stderr, "[agi] evlog: ring full, %lu records dropped\n", dropped - dropped_seen);
+        dropped_seen = dropped;
+    }
+    return true;
+}
+
+static void* drain_thread(void* arg) {
+    const struct timespec idle = {0, DRAIN_IDLE_NS};
+    while (!__atomic_load_n(&drain_stop, __ATOMIC_ACQUIRE)) {
+        if (!drain_once())
+            nanosleep(&idle, NULL);
+    }
+    while (drain_once())
+        ;
+    if (raw_out)
+        fflush(raw_out);
+    return NULL;
+}
+
+bool evlog_start(int mode) {
+    memset(&evlog_ring, 0, sizeof(evlog_ring));
+    drain_mode = mode;
+    if (mode == EVLOG_OFF)
+        return true;
+    if (mode == EVLOG_RAW) {
+        raw_out = fopen(EVLOG_PATH, "ab");
+        if (!raw_out) {
+            perror("[agi] fopen(evlog)");
+            return false;
+        }
+        if (ftell(raw_out) == 0) {
+            evlog_file_header_t h = {EVLOG_MAGIC, EVLOG_VERSION, sizeof(evlog_record_t)};
+            fwrite(&h, sizeof(h), 1, raw_out);
+        }
+    }
+    __atomic_store_n(&drain_stop, false, __ATOMIC_RELAXED);
+    int err = pthread_create(&drain, NULL, drain_thread, NULL);
+    if (err != 0) {
+        fprintf(stderr, "[agi] pthread_create(evlog): %s\n", strerror(err));
+        if (raw_out)
+            fclose(raw_out);
+        raw_out = NULL;
+        return false;
+    }
+    evlog_ring.enabled = true;
+    return true;
+}
+
+void evlog_stop(void) {
+    if (!evlog_ring.enabled)
+        return;
+    evlog_ring.enabled = false;
+    __atomic_store_n(&drain_stop, true, __ATOMIC_RELEASE);
+    pthread_join(drain, NULL);
+    if (raw_out)
+        fclose(raw_out);
+    raw_out = NULL;
+}
+
+void evlog_make_room(void) {
+    const evlog_ring_t* r = &evlog_ring;
+    const struct timespec nap = {0, DRAIN_IDLE_NS / 20};
+    while (r->enabled && r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > EVLOG_CAPACITY / 2)
+        nanosleep(&nap, NULL);
+}
+
+bool evlog_decode(const char* path, FILE* out) {
+    FILE* in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return false;
+    }
+    evlog_file_header_t h;
+    if (fread(&h, sizeof(h), 1, in) != 1 || h.magic != EVLOG_MAGIC ||
+        h.version != EVLOG_VERSION || h.record_size != sizeof(evlog_record_t)) {
+        fprintf(stderr, "[agi] %s: not an evlog v%d file\n", path, EVLOG_VERSION);
+        fclose(in);
+        return false;
+    }
+    evlog_record_t e;
+    while (fread(&e, sizeof(e), 1, in) == 1)
+        format_record(out, &e, true);
+    fclose(in);
+    return true;
+}
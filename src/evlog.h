@@ -0,0 +1,94 @@
+/*
+  evlog.h - binary event log for the hot loop
+  - the loop pushes fixed 64-byte records into a single-producer/single-consumer ring; a push is a
+    handful of stores and never blocks (a full ring drops the record and counts it)
+  - a background thread drains the ring: EVLOG=text formats the events meant for people to
+    stderr, EVLOG=raw appends every record (per-iteration ticks included) to evlog.bin for offline
+    decoding with --decode=evlog.bin, EVLOG=off disables the log
+  - only the loop thread may push; slow paths (rebuilds, population runs) keep plain fprintf
+*/
+#ifndef AGI_EVLOG_H
+#define AGI_EVLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    EVLOG_OFF,
+    EVLOG_TEXT,
+    EVLOG_RAW,
+} evlog_mode_t;
+
+#define EVLOG_MODE_COUNT 3
+extern const char* const evlog_mode_names[EVLOG_MODE_COUNT];
+
+#define EVLOG_PATH "evlog.bin"
+
+typedef enum {
+    EV_TICK,   // every iteration; a = reward
+    EV_STATUS, // every 100 iterations; a = overruns, b = ticks
+    EV_SKIP,   // chose not to mutate this cycle; a = the draw
+    EV_COUNT,
+} evlog_event_t;
+
+typedef struct {
+    uint64_t iter;
+    uint32_t event;
+    uint32_t reserved;
+    double w0, bias, running_reward;
+    double a, b; // per event, see evlog_event_t
+    double spare;
+} evlog_record_t;
+
+#define EVLOG_CAPACITY 4096 // records, a power of two
+
+typedef struct {
+    // producer and consumer indices on their own lines so neither side bounces the other's
+    _Alignas(64) uint64_t head;   // next slot to write, owned by the loop
+    uint64_t tail_cache;          // the loop's last look at tail
+    uint64_t dropped;             // records lost to a full ring, read by the drain thread
+    _Alignas(64) uint64_t tail;   // next slot to read, owned by the drain thread
+    _Alignas(64) evlog_record_t slots[EVLOG_CAPACITY];
+    bool enabled;
+} evlog_ring_t;
+
+extern evlog_ring_t evlog_ring;
+
+/* start the drain thread for 'mode'; false (and the log stays off) if it cannot */
+bool evlog_start(int mode);
+/* drain everything pushed so far and stop the thread; call before exit and exec */
+void evlog_stop(void);
+/* wait for the drain thread if the ring is over half full: for a producer that can outrun it
+   (a benchmark's tight loop) to call where the wait costs nothing, so no record is dropped */
+void evlog_make_room(void);
+/* print every record of a raw log as text, false if it is not one */
+bool evlog_decode(const char* path, FILE* out);
+
+static inline void evlog_push(uint32_t event, uint64_t iter, double w0, double bias, double rr,
+                              double a, double b) {
+    evlog_ring_t* r = &evlog_ring;
+    if (!r->enabled)
+        return;
+    uint64_t head = r->head;
+    if (head - r->tail_cache >= EVLOG_CAPACITY) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head - r->tail_cache >= EVLOG_CAPACITY) {
+            // only the loop writes it, so a load and a store make the increment
+            __atomic_store_n(&r->dropped, __atomic_load_n(&r->dropped, __ATOMIC_RELAXED) + 1,
+                             __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    evlog_record_t* s = &r->slots[head & (EVLOG_CAPACITY - 1)];
+    s->iter = iter;
+    s->event = event;
+    s->w0 = w0;
+    s->bias = bias;
+    s->running_reward = rr;
+    s->a = a;
+    s->b = b;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
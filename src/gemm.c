@@ -0,0 +1,206 @@
+#include "gemm.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GEMM_X86 1
+#include <immintrin.h>
+#endif
+
+/* register tile and cache blocks. an A block (MC x KC, 128 KiB) sits in L2 while a KC x NR
+   sliver of B (16 KiB) streams through L1; the B panel (KC x NC, 512 KiB) is reused for every
+   A block */
+#define MR 4
+#define NR 8
+#define MC 64
+#define KC 256
+#define NC 256
+#define SMALL_FLOPS (16 * 16 * 16) // below this m * n * k the packing costs more than it saves
+#define PACK_ALIGN 64
+
+/* element (i, p) of op(A) and (p, j) of op(B) */
+static inline double at_a(const double* a, size_t lda, bool t, size_t i, size_t p) {
+    return t ? a[p * lda + i] : a[i * lda + p];
+}
+
+static inline double at_b(const double* b, size_t ldb, bool t, size_t p, size_t j) {
+    return t ? b[j * ldb + p] : b[p * ldb + j];
+}
+
+/* --- micro-kernels: tile[MR][NR] = sum over p < kc of a[p][:] (x) b[p][:] --- */
+static void micro_scalar(size_t kc, const double* a, const double* b, double* tile) {
+    double acc[MR][NR] = {{0}};
+    for (size_t p = 0; p < kc; p++) {
+        for (int i = 0; i < MR; i++) {
+            for (int j = 0; j < NR; j++)
+                acc[i][j] += a[p * MR + (size_t)i] * b[p * NR + (size_t)j];
+        }
+    }
+    memcpy(tile, acc, sizeof(acc));
+}
+
+#ifdef GEMM_X86
+/* --- avx2+fma: two vectors per row of the tile, eight accumulators --- */
+__attribute__((target("avx2,fma"))) static void micro_avx2(size_t kc, const double* a,
+                                                           const double* b, double* tile) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    for (size_t p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_load_pd(b + p * NR);
+        __m256d b1 = _mm256_load_pd(b + p * NR + 4);
+        __m256d x = _mm256_broadcast_sd(a + p * MR);
+        c00 = _mm256_fmadd_pd(x, b0, c00);
+        c01 = _mm256_fmadd_pd(x, b1, c01);
+        x = _mm256_broadcast_sd(a + p * MR + 1);
+        c10 = _mm256_fmadd_pd(x, b0, c10);
+        c11 = _mm256_fmadd_pd(x, b1, c11);
+        x = _mm256_broadcast_sd(a + p * MR + 2);
+        c20 = _mm256_fmadd_pd(x, b0, c20);
+        c21 = _mm256_fmadd_pd(x, b1, c21);
+        x = _mm256_broadcast_sd(a + p * MR + 3);
+        c30 = _mm256_fmadd_pd(x, b0, c30);
+        c31 = _mm256_fmadd_pd(x, b1, c31);
+    }
+    _mm256_storeu_pd(tile, c00);
+    _mm256_storeu_pd(tile + 4, c01);
+    _mm256_storeu_pd(tile + 8, c10);
+    _mm256_storeu_pd(tile + 12, c11);
+    _mm256_storeu_pd(tile + 16, c20);
+    _mm256_storeu_pd(tile + 20, c21);
+    _mm256_storeu_pd(tile + 24, c30);
+    _mm256_storeu_pd(tile + 28, c31);
+    _mm256_zeroupper();
+}
+#endif
+
+static void (*micro_kernel)(size_t kc, const double* a, const double* b, double* tile) =
+        micro_scalar;
+static const char* micro_name = "scalar";
+
+void gemm_init(void) {
+    micro_kernel = micro_scalar;
+    micro_name = "scalar";
+#ifdef GEMM_X86
+    if (vec_has_avx2()) {
+        micro_kernel = micro_avx2;
+        micro_name = "avx2";
+    }
+#endif
+}
+
+const char* gemm_kernel(void) {
+    return micro_name;
+}
+
+/* --- packing: micro-panels of MR rows of A / NR columns of B, k-major, zero padded --- */
+static void pack_a(const double* a, size_t lda, bool t, size_t i0, size_t mc, size_t p0,
+                   size_t kc, double* dst) {
+    for (size_t ir = 0; ir < mc; ir += MR) {
+        for (size_t p = 0; p < kc; p++) {
+            for (size_t i = 0; i < MR; i++)
+                *dst++ = ir + i < mc ? at_a(a, lda, t, i0 + ir + i, p0 + p) : 0.0;
+        }
+    }
+}
+
+static void pack_b(const double* b, size_t ldb, bool t, size_t p0, size_t kc, size_t j0,
+                   size_t nc, double* dst) {
+    for (size_t jr = 0; jr < nc; jr += NR) {
+        for (size_t p = 0; p < kc; p++) {
+            for (size_t j = 0; j < NR; j++)
+                *dst++ = jr + j < nc ? at_b(b, ldb, t, p0 + p, j0 + jr + j) : 0.0;
+        }
+    }
+}
+
+static void gemm_small(bool ta, bool tb, size_t m, size_t n, size_t k, double alpha,
+                       const double* a, size_t lda, const double* b, size_t ldb, double* c,
+                       size_t ldc) {
+    for (size_t i = 0; i < m; i++) {
+        for (size_t j = 0; j < n; j++) {
+            double s = 0;
+            for (size_t p = 0; p < k; p++)
+                s += at_a(a, lda, ta, i, p) * at_b(b, ldb, tb, p, j);
+            c[i * ldc + j] += alpha * s;
+        }
+    }
+}
+
+/* per-thread pack buffers, allocated on first use and kept until the thread exits: a key with a
+   destructor frees them, so pool workers retired by a THREADS change do not leak theirs */
+static _Thread_local double* pack_a_buf = NULL;
+static _Thread_local double* pack_b_buf = NULL;
+static pthread_key_t pack_key;
+static pthread_once_t pack_once = PTHREAD_ONCE_INIT;
+
+static void free_pack_buffers(void* unused) {
+    (void)unused;
+    free(pack_a_buf);
+    free(pack_b_buf);
+    pack_a_buf = pack_b_buf = NULL;
+}
+
+static void make_pack_key(void) {
+    pthread_key_create(&pack_key, free_pack_buffers);
+}
+
+static bool pack_buffers(void) {
+    if (pack_a_buf && pack_b_buf)
+        return true;
+    pthread_once(&pack_once, make_pack_key);
+    if (!pack_a_buf)
+        pack_a_buf = aligned_alloc(PACK_ALIGN, MC * KC * sizeof(double));
+    if (!pack_b_buf)
+        pack_b_buf = aligned_alloc(PACK_ALIGN, KC * NC * sizeof(double));
+    // any non-NULL value arms the destructor for this thread
+    pthread_setspecific(pack_key, &pack_a_buf);
+    return pack_a_buf && pack_b_buf;
+}
+
+void gemm(bool ta, bool tb, size_t m, size_t n, size_t k, double alpha, const double* a,
+          size_t lda, const double* b, size_t ldb, double beta, double* c, size_t ldc) {
+    // beta first, so every k block below just accumulates. beta = 0 must not keep NaNs
+    if (beta != 1.0) {
+        for (size_t i = 0; i < m; i++) {
+            double* row = c + i * ldc;
+            for (size_t j = 0; j < n; j++)
+                row[j] = beta == 0.0 ? 0.0 : beta * row[j];
+        }
+    }
+    if (m == 0 || n == 0 || k == 0 || alpha == 0.0)
+        return;
+    if (m * n * k < SMALL_FLOPS || !pack_buffers()) {
+        gemm_small(ta, tb, m, n, k, alpha, a, lda, b, ldb, c, ldc);
+        return;
+    }
+    double tile[MR * NR];
+    for (size_t jc = 0; jc < n; jc += NC) {
+        size_t nc = n - jc < NC ? n - jc : NC;
+        for (size_t pc = 0; pc < k; pc += KC) {
+            size_t kc = k - pc < KC ? k - pc : KC;
+            pack_b(b, ldb, tb, pc, kc, jc, nc, pack_b_buf);
+            for (size_t ic = 0; ic < m; ic += MC) {
+                size_t mc = m - ic < MC ? m - ic : MC;
+                pack_a(a, lda, ta, ic, mc, pc, kc, pack_a_buf);
+                for (size_t jr = 0; jr < nc; jr += NR) {
+                    for (size_t ir = 0; ir < mc; ir += MR) {
+                        micro_kernel(kc, pack_a_buf + ir * kc, pack_b_buf + jr * kc, tile);
+                        size_t mr = mc - ir < MR ? mc - ir : MR;
+                        size_t nr = nc - jr < NR ? nc - jr : NR;
+                        for (size_t i = 0; i < mr; i++) {
+                            double* row = c + (ic + ir + i) * ldc + jc + jr;
+                            for (size_t j = 0; j < nr; j++)
+                                row[j] += alpha * tile[i * NR + j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,27 @@
+/*
+  gemm.h - dense matrix multiply for the mlp
+  - C = alpha * op(A) * op(B) + beta * C over row-major doubles, op() an optional transpose
+  - cache blocked: a KC x NC panel of B and an MC x KC block of A are packed into contiguous
+    micro-panels (zero padded), so the micro-kernel streams both with unit stride
+  - the micro-kernel keeps a 4 x 8 tile of C in registers: avx2+fma or portable C
+  - products too small to pay for the packing run as plain loops
+  - gemm_init() picks the kernel matching the selected vec set (call it after vec_init)
+*/
+#ifndef AGI_GEMM_H
+#define AGI_GEMM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* op(A) is m x k, op(B) is k x n, C is m x n; lda/ldb/ldc are the row strides as stored */
+typedef void (*gemm_fn_t)(bool trans_a, bool trans_b, size_t m, size_t n, size_t k, double alpha,
+                          const double* a, size_t lda, const double* b, size_t ldb, double beta,
+                          double* c, size_t ldc);
+
+void gemm_init(void);
+/* name of the selected micro-kernel */
+const char* gemm_kernel(void);
+void gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k, double alpha, const double* a,
+          size_t lda, const double* b, size_t ldb, double beta, double* c, size_t ldc);
+
+#endif
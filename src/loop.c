@@ -0,0 +1,209 @@
+#include "loop.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "evlog.h"
+#include "pool.h"
+#include "replay.h"
+#include "rng.h"
+#include "state.h"
+#include "stm.h"
+#include "wal.h"
+
+#define REFILL_CHUNK 64 // feature vectors per pool task
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/* keep the step just learned from and replay a minibatch of earlier ones */
+static void replay_step(const policy_api_t* policy, policy_ctx_t* ctx, const config_t* cfg,
+                        const double* phi, double reward, uint64_t iter) {
+    if (cfg->replay_capacity == 0)
+        return;
+    replay_push(phi, reward, iter);
+    replay_train(policy, ctx, rng_local_bulk(), cfg->replay_sampling, (size_t)cfg->replay_batch,
+                 cfg->optimizer, cfg->epochs, cfg->learning_rate);
+}
+
+/* the online rule learns from each step as it comes; the minibatch optimizers only note the
+   reward here and train once the batch is complete (or from replay, with that on) */
+static void learn_online(const policy_api_t* policy, policy_ctx_t* ctx, const config_t* cfg,
+                         const double* phi, double reward) {
+    if (cfg->optimizer == OPTIM_NLMS)
+        policy->update(ctx, phi, reward, cfg->learning_rate);
+    else
+        policy->observe(ctx, reward);
+}
+
+/* EPOCHS minibatch steps over n consecutive feature vectors in 'phi' and their rewards */
+static void train_batch(const policy_api_t* policy, policy_ctx_t* ctx, const config_t* cfg,
+                        const double* phi, const double* reward, size_t n) {
+    if (cfg->optimizer == OPTIM_NLMS || cfg->replay_capacity > 0)
+        return;
+    const double* rows[BATCH_MAX];
+    for (size_t i = 0; i < n; i++)
+        rows[i] = phi + i * ctx->core->n_features;
+    for (int e = 0; e < cfg->epochs; e++)
+        policy->train(ctx, rows, reward, NULL, n, cfg->optimizer, cfg->learning_rate);
+}
+
+/* parameters in use: the mlp's, or the feature weights */
+static size_t params_in_use(const policy_ctx_t* ctx) {
+    return ctx->mlp && ctx->mlp->n_hidden ? (size_t)ctx->mlp->n_params
+                                          : (size_t)ctx->core->n_features;
+}
+
+double loop_learn_one(const policy_api_t* policy, policy_ctx_t* ctx, const config_t* cfg,
+                      double* phi, uint64_t iter) {
+    // perception: feature vector derived from the step counter
+    int it = (int)iter;
+    policy->features(it, phi, ctx->core->n_features);
+    double out = policy->forward(ctx, phi);
+    // act: sign of out
+    double reward = env_reward(it, out);
+    // learn
+    learn_online(policy, ctx, cfg, phi, reward);
+    train_batch(policy, ctx, cfg, phi, &reward, 1);
+    replay_step(policy, ctx, cfg, phi, reward, iter);
+    return reward;
+}
+
+bool loop_init(loop_t* l, policy_ctx_t* ctx, size_t batch) {
+    *l = (loop_t){.ctx = ctx};
+    return env_batch_init(&l->env, batch);
+}
+
+void loop_free(loop_t* l) {
+    env_batch_free(&l->env);
+    free(l->phi);
+    l->phi = NULL;
+    l->phi_len = 0;
+}
+
+bool loop_resize(loop_t* l, size_t batch) {
+    env_batch_free(&l->env);
+    loop_discard(l);
+    return env_batch_init(&l->env, batch);
+}
+
+typedef struct {
+    const loop_t* l;
+    const policy_api_t* policy;
+} refill_job_t;
+
+static void refill_features(void* arg, size_t task, size_t worker) {
+    const refill_job_t* job = arg;
+    const loop_t* l = job->l;
+    uint64_t nf = l->ctx->core->n_features;
+    size_t end = (task + 1) * REFILL_CHUNK < l->env.n ? (task + 1) * REFILL_CHUNK : l->env.n;
+    for (size_t j = task * REFILL_CHUNK; j < end; j++) {
+        l->env.iter[j] = (int32_t)(l->base + j);
+        job->policy->features(l->env.iter[j], l->phi + j * nf, nf);
+    }
+}
+
+bool loop_refill(loop_t* l, const policy_api_t* policy, uint64_t base) {
+    size_t need = l->env.cap * l->ctx->core->n_features;
+    if (l->phi_len < need) {
+        double* phi = realloc(l->phi, need * sizeof(double));
+        if (!phi) {
+            perror("realloc(phi)");
+            return false;
+        }
+        l->phi = phi;
+        l->phi_len = need;
+    }
+    // the actions all come from the current weights
+    l->env.n = l->env.cap;
+    l->cursor = 0;
+    l->base = base;
+    refill_job_t job = {l, policy};
+    pool_run((l->env.n + REFILL_CHUNK - 1) / REFILL_CHUNK, refill_features, &job);
+    policy->forward_batch(l->ctx, l->phi, l->env.n, l->env.action);
+    env_step(&l->env);
+    return true;
+}
+
+uint64_t loop_learn(loop_t* l, const policy_api_t* policy, const config_t* cfg) {
+    policy_ctx_t* ctx = l->ctx;
+    stm_core_t* core = ctx->core;
+    uint64_t it = l->base + l->cursor;
+    const double* phi = l->phi + l->cursor * core->n_features;
+    double reward = l->env.reward[l->cursor];
+    learn_online(policy, ctx, cfg, phi, reward);
+    replay_step(policy, ctx, cfg, phi, reward, it);
+    l->cursor++;
+    if (l->cursor == l->env.n)
+        train_batch(policy, ctx, cfg, l->phi, l->env.reward, l->env.n);
+    if (cfg->sync_mode == SYNC_WAL && wal_is_open())
+        wal_append(it, reward, ctx->weights, params_in_use(ctx), core);
+    // a few stores into the event ring; formatting happens on the drain thread
+    evlog_push(EV_TICK, it, ctx->weights[0], core->bias, core->running_reward, reward, 0);
+    return it;
+}
+
+/* commit the sections the loop writes: the rest only change on paths that commit in full */
+static void commit_learned(const loop_t* l, const config_t* cfg, int flags) {
+    const policy_ctx_t* ctx = l->ctx;
+    stm_dirty(ctx->core);
+    stm_dirty(ctx->weights);
+    if (cfg->optimizer != OPTIM_NLMS) {
+        stm_dirty(ctx->optim);
+        stm_dirty(ctx->optim_m);
+        stm_dirty(ctx->optim_v);
+    }
+    if (wal_is_open())
+        stm_dirty(stm_section("wal", NULL));
+    stm_commit_dirty(flags);
+}
+
+void loop_commit(loop_t* l, const config_t* cfg) {
+    uint64_t iter = l->ctx->core->iter;
+    switch (cfg->sync_mode) {
+        case SYNC_ALWAYS:
+            commit_learned(l, cfg, MS_SYNC);
+            return;
+        case SYNC_WAL:
+            if (wal_is_open()) {
+                // the log carries the updates between checkpoints, its records flushed in groups
+                if (iter - l->last_flush >= (uint64_t)cfg->sync_interval) {
+                    wal_flush(true);
+                    l->last_flush = iter;
+                }
+                if (iter - l->last_commit < (uint64_t)cfg->checkpoint_interval)
+                    return;
+                wal_flush(true);
+                wal_rotate();
+                commit_learned(l, cfg, MS_SYNC);
+                wal_checkpoint(iter);
+                l->last_commit = iter;
+                l->last_ms = now_ms();
+                return;
+            }
+            // no log: commit as SYNC_MODE=interval would
+            // fall through
+        case SYNC_INTERVAL:
+            if (iter - l->last_commit < (uint64_t)cfg->sync_interval)
+                return;
+            break;
+        case SYNC_TIME:
+            if (now_ms() - l->last_ms < (uint64_t)cfg->sync_budget_ms)
+                return;
+            break;
+        case SYNC_ASYNC:
+            if (iter - l->last_commit < (uint64_t)cfg->sync_interval)
+                return;
+            commit_learned(l, cfg, MS_ASYNC);
+            l->last_commit = iter;
+            return;
+    }
+    commit_learned(l, cfg, MS_SYNC);
+    l->last_commit = iter;
+    l->last_ms = now_ms();
+}
@@ -0,0 +1,64 @@
+/*
+  loop.h - one iteration of the learning loop, shared by main() and the benchmarks
+  - BATCH environment steps are taken at once from the current weights (loop_refill), then
+    learned from one step per iteration: online rule, minibatch at the end of the batch, replay,
+    a write-ahead log record and a tick in the event log (loop_learn)
+  - loop_commit makes the arena durable as SYNC_MODE asks, copying only what the loop writes
+  - what main() layers on top (status lines, mutations, rollbacks, hogwild workers, reloads)
+    stays in main.c; the benchmarks time exactly the code main runs
+*/
+#ifndef AGI_LOOP_H
+#define AGI_LOOP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "env.h"
+#include "policy.h"
+
+typedef struct {
+    policy_ctx_t* ctx; // the learner's sections; core->n_features is the feature count
+    env_batch_t env;   // the batch being learned from
+    double* phi;       // a feature vector per step of the batch, back to back
+    size_t phi_len;    // doubles phi has room for
+    size_t cursor;     // the batch's next step
+    uint64_t base;     // the iteration of its first step
+    // where loop_commit last committed, flushed the log and the time of the last commit
+    uint64_t last_commit;
+    uint64_t last_flush;
+    uint64_t last_ms;
+} loop_t;
+
+/* a batch of 'batch' steps for 'ctx'; false if it cannot be allocated */
+bool loop_init(loop_t* l, policy_ctx_t* ctx, size_t batch);
+void loop_free(loop_t* l);
+/* a new batch size; the steps already taken are dropped */
+bool loop_resize(loop_t* l, size_t batch);
+
+/* whether the batch is used up, so loop_refill must run before the next loop_learn */
+static inline bool loop_drained(const loop_t* l) {
+    return l->cursor == l->env.n;
+}
+
+/* drop the steps taken but not yet learned from (they came from other weights or features) */
+static inline void loop_discard(loop_t* l) {
+    l->env.n = 0;
+    l->cursor = 0;
+}
+
+/* take a batch of steps from iteration 'base' on: features and forward pass over the thread
+   pool, then the environment. false if phi cannot grow */
+bool loop_refill(loop_t* l, const policy_api_t* policy, uint64_t base);
+/* learn from the batch's next step, returns its iteration */
+uint64_t loop_learn(loop_t* l, const policy_api_t* policy, const config_t* cfg);
+/* commit the arena if SYNC_MODE says it is time; call once per iteration */
+void loop_commit(loop_t* l, const config_t* cfg);
+
+/* a whole perceive/act/learn step at 'iter' outside any batch (forked evaluators and workers);
+   'phi' has room for n_features. returns the reward */
+double loop_learn_one(const policy_api_t* policy, policy_ctx_t* ctx, const config_t* cfg,
+                      double* phi, uint64_t iter);
+
+#endif
@@ -1,239 +1,492 @@
 /*
   agi.c - minimal self-modifying single-binary scaffold
   - maps short-term memory file "stm.dat" (persisted across exec)
-  - has a tiny learner (one weight + bias) stored in STM
-  - contains an editable config block between BEGIN_CONFIG / END_CONFIG
-  - every N iterations it mutates the config, runs "make", and execs the program
-  - compile: gcc -O2 -Wall -o agi agi.c
-  - run: ./agi
+  - has a tiny linear learner (weight vector + bias) stored in STM
+  - the learner itself lives in policy.c, hot-reloaded from build/libagi_policy.so
+  - contains an editable config block between BEGIN_CONFIG / END_CONFIG, compiled into the
+    config.bin sidecar (see config.h) so the loop never parses it
+  - every N iterations it mutates the config, runs "make", and reloads the policy (or execs the
+    program, with RELOAD_MODE=exec)
+  - the environment is stepped BATCH instances at a time (env.c); the learner consumes the
+    rewards one step per iteration
+  - with POPULATION=K, K candidate configs are scored side by side in forked workers first and
+    only the best one is written back
+  - MLP_HIDDEN=w1,w2,.. swaps the linear learner for a multi-layer perceptron on cache-blocked
+    gemm kernels (mlp.h, gemm.h)
+  - OPTIMIZER=sgd|momentum|adam trains on whole minibatches (the consumed environment batch, or
+    replayed samples) EPOCHS times instead of the online rule, with its state in STM
+  - with REPLAY_CAPACITY set, every step is also stored in a replay ring in STM and a minibatch
+    of past steps is replayed after it (replay.h)
+  - THREADS=N spreads minibatch gradients and batched environment steps over a work-stealing
+    thread pool (pool.h); DETERMINISTIC=1 keeps the gradient sums in a fixed order, so seeded
+    runs repeat exactly for a given THREADS
+  - WORKERS=N forks N-1 more learners onto the same arena: Hogwild-style lock-free updates of
+    the shared weights, each process claiming its iterations with an atomic add on core->iter
+  - SYNC_MODE=wal appends every update to a write-ahead log (wal.h) and commits the arena only
+    every CHECKPOINT_INTERVAL iterations; after a crash the log's tail is replayed on startup
+  - every mutation is on trial for EVAL_WINDOW iterations: SNAPSHOT=auto|diff snapshots the arena
+    first (snapshot.h), and a drop in running_reward rolls the arena and the block back
+  - STM_HUGEPAGES=advise|hugetlb, STM_LOCK=1 and STM_PREFAULT=1 keep the arena in huge, locked,
+    prefaulted pages (stm.h); the startup line "[agi] stm:" says what the kernel granted
+  - the loop logs through a binary event ring drained by a background thread (evlog.h),
+    EVLOG=raw keeps every iteration for offline decoding with --decode=evlog.bin
+  - every restart is timed phase by phase, from the mutation to the new generation's first
+    iteration, and logged as "[agi] restart N: ..." (restart.h). BUILD_LINK=static rebuilds a
+    static binary that execs without the dynamic loader
+  - compile: make [PROFILE=debug|release|pgo-use] [LINK=static], or make pgo for a profile-guided
+    build
+  - run: ./build/agi
 */
 
 /* ===== BEGIN_CONFIG
 LEARNING_RATE=0.05
 MUTATION_PROB=0.50
 RECOMPILE_INTERVAL=10
+SYNC_MODE=interval
+SYNC_INTERVAL=100
+SYNC_BUDGET_MS=1000
+TICK_MODE=fixed
+TICK_HZ=10
+FEATURES=64
+RELOAD_MODE=dlopen
+POPULATION=1
+EVAL_WINDOW=200
+BATCH=1
+BUILD_PROFILE=release
+EVLOG=text
+SEED=0
+REPLAY_CAPACITY=0
+REPLAY_BATCH=32
+REPLAY_SAMPLING=prioritized
+OPTIMIZER=nlms
+EPOCHS=1
+MLP_HIDDEN=0
+MLP_ACTIVATION=relu
+THREADS=1
+DETERMINISTIC=1
+WORKERS=1
+SNAPSHOT=auto
+CHECKPOINT_INTERVAL=10000
+STM_HUGEPAGES=off
+STM_LOCK=0
+STM_PREFAULT=0
+BUILD_LINK=dynamic
   ===== END_CONFIG */
 
 #define _GNU_SOURCE
+#include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
-/* --- short-term memory layout (persisted in a file via mmap) --- */
-#define STM_PATH "stm.dat"
-#define STM_SIZE 4096
-
-typedef struct {
-    uint64_t magic;
-    uint64_t version;
-    uint64_t iter;
-    double weight; // simple single-weight learner
-    double bias;
-    double running_reward;
-    char scratch[256];
-} stm_t;
+#include "buildcache.h"
+#include "config.h"
+#include "env.h"
+#include "evlog.h"
+#include "gemm.h"
+#include "loop.h"
+#include "migrate.h"
+#include "mlp.h"
+#include "policy.h"
+#include "pool.h"
+#include "replay.h"
+#include "restart.h"
+#include "rng.h"
+#include "snapshot.h"
+#include "state.h"
+#include "stm.h"
+#include "tick.h"
+#include "vec.h"
+#include "wal.h"
+#include "watch.h"
 
-static stm_t* stm = NULL;
+/* where the source lives and its cksum (config block excluded), baked in by the Makefile */
+#ifndef AGI_SOURCE_PATH
+#define AGI_SOURCE_PATH ""
+#endif
+#ifndef AGI_SOURCE_CKSUM
+#define AGI_SOURCE_CKSUM 0u
+#endif
 
-/* magic & version values to detect layout mismatch */
-enum { STM_MAGIC = 0xA51A6F257F3C1BULL, STM_VERSION = 1 };
+/* --- short-term memory layout (persisted in a file via mmap, see stm.h and state.h) --- */
+#define STM_PATH "stm.dat"
 
-/* --- helper: read config block in this source file (parser for the BEGIN_CONFIG block) --- */
-typedef struct {
-    double learning_rate;
-    double mutation_prob;
-    int recompile_interval;
-} config_t;
+/* section pointers, valid until the mapping next moves (see bind_sections) */
+static stm_core_t* core = NULL;
+static double* weights = NULL; // section "weights": n_features doubles, durable
+static stm_stats_t* stats = NULL;
+static stm_optim_t* optim = NULL;
+static double* optim_m = NULL; // sections "optim_m" and "optim_v": n_features doubles, durable
+static double* optim_v = NULL;
+static double* grad = NULL; // the trainer's scratch, see bind_scratch
+static stm_mlp_t* mlp = NULL; // section "mlp": the network's shape, durable
+static double* mlp_work = NULL; // the network's scratch, mlp_work_size() doubles per thread
 
-static config_t config_defaults = {0.05, 0.5, 10};
+/* the active learner and the state it is handed; see policy.h */
+static const policy_api_t* policy = NULL;
+static policy_ctx_t pctx;
 
-/* parse numeric value after 'KEY=' on a line, returns true if set */
-static bool parse_config_line(const char* line, config_t* cfg) {
-    if (strncmp(line, "LEARNING_RATE=", 14) == 0) {
-        cfg->learning_rate = atof(line + 14);
-        return true;
-    } else if (strncmp(line, "MUTATION_PROB=", 13) == 0) {
-        cfg->mutation_prob = atof(line + 13);
-        return true;
-    } else if (strncmp(line, "RECOMPILE_INTERVAL=", 19) == 0) {
-        cfg->recompile_interval = atoi(line + 19);
-        return true;
-    }
-    return false;
+/* --- STM management --- */
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
 }
 
-/* open this source file and find the config block, parse numbers */
-static config_t read_config_from_source(const char* selfpath) {
-    config_t cfg = config_defaults;
-    FILE* f = fopen(selfpath, "r");
-    if (!f)
-        return cfg;
-    char line[512];
-    bool in_block = false;
-    while (fgets(line, sizeof(line), f)) {
-        if (strstr(line, "BEGIN_CONFIG")) {
-            in_block = true;
-            continue;
-        }
-        if (strstr(line, "END_CONFIG")) {
-            in_block = false;
-            break;
-        }
-        if (in_block) {
-            // trim whitespace
-            char* s = line;
-            while (*s == ' ' || *s == '\t')
-                s++;
-            parse_config_line(s, &cfg);
+/* the trainer's scratch for the pool's thread count: a gradient copy per thread (as long as the
+   weights section, plus the bias) and with an mlp, a work buffer per thread */
+static bool bind_scratch(void) {
+    size_t threads = pool_threads();
+    uint64_t cap = 0;
+    stm_section("weights", &cap);
+    double* g = realloc(grad, threads * (cap / sizeof(double) + 1) * sizeof(double));
+    if (!g) {
+        perror("realloc(grad)");
+        return false;
+    }
+    grad = g;
+    if (mlp->n_hidden) {
+        double* w = realloc(mlp_work, threads * mlp_work_size(mlp) * sizeof(double));
+        if (!w) {
+            perror("realloc(mlp_work)");
+            return false;
         }
+        mlp_work = w;
     }
-    fclose(f);
-    return cfg;
+    pctx.grad = grad;
+    pctx.work = mlp_work;
+    pctx.parallel = pool_run;
+    pctx.threads = threads;
+    return true;
 }
 
-/* mutate the config block in-place: random tweaks */
-static bool mutate_source_config(const char* selfpath, double mutation_prob) {
-    FILE* in = fopen(selfpath, "r");
-    if (!in)
-        return false;
-    char tmp_path[512];
-    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", selfpath, (int)getpid());
-    FILE* out = fopen(tmp_path, "w");
-    if (!out) {
-        fclose(in);
+/* make sure every section exists with room for 'n_weights' parameters (the feature weights, or
+   the mlp's) and refresh the pointers */
+static bool bind_sections(uint64_t n_weights) {
+    if (!stm_reserve("core", sizeof(stm_core_t), STM_DURABLE) ||
+        !stm_reserve("weights", n_weights * sizeof(double), STM_DURABLE) ||
+        !stm_reserve("stats", sizeof(stm_stats_t), 0) ||
+        !stm_reserve("optim", sizeof(stm_optim_t), STM_DURABLE) ||
+        !stm_reserve("optim_m", n_weights * sizeof(double), STM_DURABLE) ||
+        !stm_reserve("optim_v", n_weights * sizeof(double), STM_DURABLE) ||
+        !stm_reserve("mlp", sizeof(stm_mlp_t), STM_DURABLE) ||
+        !stm_reserve("wal", sizeof(stm_wal_t), STM_DURABLE) ||
+        !stm_reserve("restart", sizeof(stm_restart_t), 0))
         return false;
-    }
+    // any reserve may have moved the mapping, so look everything up afterwards
+    core = stm_section("core", NULL);
+    weights = stm_section("weights", NULL);
+    stats = stm_section("stats", NULL);
+    optim = stm_section("optim", NULL);
+    optim_m = stm_section("optim_m", NULL);
+    optim_v = stm_section("optim_v", NULL);
+    mlp = stm_section("mlp", NULL);
+    restart_bind(stm_section("restart", NULL));
+    pctx.core = core;
+    pctx.weights = weights;
+    pctx.vec = vec;
+    pctx.optim = optim;
+    pctx.optim_m = optim_m;
+    pctx.optim_v = optim_v;
+    pctx.mlp = mlp;
+    pctx.gemm = gemm;
+    return bind_scratch();
+}
+
+static void tune_stm(const config_t* cfg) {
+    stm_tuning_t t = {cfg->stm_hugepages, cfg->stm_lock, cfg->stm_prefault};
+    stm_tune(&t);
+}
 
+static void report_stm(void) {
     char line[512];
-    bool in_block = false;
-    while (fgets(line, sizeof(line), in)) {
-        if (strstr(line, "BEGIN_CONFIG")) {
-            in_block = true;
-            fputs(line, out);
-            /* write mutated config lines */
-            // read original lines until END_CONFIG and discard them
-            while (fgets(line, sizeof(line), in)) {
-                if (strstr(line, "END_CONFIG"))
-                    break;
-            }
-            // compute new values and write replacements
-            double lr = config_defaults.learning_rate *
-                        (1.0 + ((rand() / (double)RAND_MAX) - 0.5) * 0.5);
-            if ((rand() / (double)RAND_MAX) < mutation_prob) {
-                lr = lr * (1.0 + ((rand() / (double)RAND_MAX) - 0.5) * 0.5);
-                if (lr <= 0)
-                    lr = 0.001;
-            }
-            double mp = config_defaults.mutation_prob;
-            if ((rand() / (double)RAND_MAX) < mutation_prob) {
-                mp = fmin(0.99, fmax(0.01, mp + ((rand() / (double)RAND_MAX) - 0.5) * 0.2));
-            }
-            int ri = config_defaults.recompile_interval;
-            if ((rand() / (double)RAND_MAX) < mutation_prob) {
-                int delta = (rand() % 5) - 2;
-                ri = fmax(1, ri + delta);
-            }
-            // Write new block lines
-            fprintf(out, "LEARNING_RATE=%.6f\n", lr);
-            fprintf(out, "MUTATION_PROB=%.6f\n", mp);
-            fprintf(out, "RECOMPILE_INTERVAL=%d\n", ri);
-            // write END_CONFIG marker
-            fputs("  ===== END_CONFIG */\n", out); // note: maintain comment formatting
-            // Now we must continue copying until end (we already wrote END_CONFIG; but source had
-            // the trailing "*/") We continue reading the remainder of the original file and write
-            // it out.
-            while (fgets(line, sizeof(line), in)) {
-                fputs(line, out);
-            }
-            // done
-            break;
-        } else {
-            fputs(line, out);
-        }
-    }
+    stm_report(line, sizeof(line));
+    fprintf(stderr, "[agi] stm: %s\n", line);
+}
 
-    fclose(in);
-    fclose(out);
-    // atomically replace
-    if (rename(tmp_path, selfpath) != 0) {
-        unlink(tmp_path);
+static bool map_stm_file(const char* path) {
+    if (!stm_migrate_legacy(path))
+        return false;
+    stm_open_t r = stm_open(path);
+    if (r == STM_ERROR || (r == STM_RESUMED && !stm_upgrade_sections()) || !bind_sections(1))
         return false;
+    if (r == STM_FRESH) {
+        stm_stamp_layouts();
+        core->iter = 0;
+        core->n_features = 1;
+        weights[0] = 0.1; // small initial weight
+        core->bias = 0.0;
+        core->running_reward = 0.0;
+        snprintf(stats->scratch, sizeof(stats->scratch), "fresh");
+        stm_commit(MS_SYNC);
     }
     return true;
 }
 
-/* --- STM management --- */
-static bool map_stm_file(const char* path) {
-    int fd = open(path, O_RDWR | O_CREAT, 0600);
-    if (fd < 0) {
-        perror("open(stm)");
-        return false;
-    }
-    if (ftruncate(fd, STM_SIZE) != 0) {
-        perror("ftruncate");
-        close(fd);
+/* grow or shrink the live weight vector; new weights start at zero, dropped ones are cleared so a
+   later regrowth starts clean as well */
+static bool stm_resize_features(uint64_t n) {
+    uint64_t cap = 0;
+    stm_section("weights", &cap);
+    if (n * sizeof(double) > cap && !bind_sections(n))
         return false;
+    if (n < core->n_features) {
+        size_t dropped = (core->n_features - n) * sizeof(double);
+        memset(weights + n, 0, dropped);
+        memset(optim_m + n, 0, dropped);
+        memset(optim_v + n, 0, dropped);
+        stm_dirty(weights);
+        stm_dirty(optim_m);
+        stm_dirty(optim_v);
     }
-    void* p = mmap(NULL, STM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    close(fd);
-    if (p == MAP_FAILED) {
-        perror("mmap");
+    core->n_features = n;
+    stm_dirty(core);
+    return true;
+}
+
+/* the model 'cfg' asks for: the linear learner over cfg->features, or an mlp on top of them. a
+   different mlp shape, or a switch between the two, starts the new model from scratch */
+static bool bind_model(const config_t* cfg) {
+    if (!stm_resize_features((uint64_t)cfg->features))
         return false;
+    stm_mlp_t want = {0};
+    if (cfg->mlp_layers > 0) {
+        want.n_hidden = (uint64_t)cfg->mlp_layers;
+        want.n_inputs = (uint64_t)cfg->features;
+        for (int l = 0; l < cfg->mlp_layers; l++)
+            want.width[l] = (uint64_t)cfg->mlp_width[l];
+        want.activation = (uint64_t)cfg->mlp_activation;
+        want.n_params = mlp_param_count(&want);
     }
-    stm = (stm_t*)p;
-    // initialize if magic mismatch
-    if (stm->magic != STM_MAGIC || stm->version != STM_VERSION) {
-        memset(stm, 0, sizeof(stm_t));
-        stm->magic = STM_MAGIC;
-        stm->version = STM_VERSION;
-        stm->iter = 0;
-        stm->weight = 0.1; // small initial weight
-        stm->bias = 0.0;
-        stm->running_reward = 0.0;
-        snprintf(stm->scratch, sizeof(stm->scratch), "fresh");
-        msync(stm, sizeof(stm_t), MS_SYNC);
+    if (memcmp(&want, mlp, sizeof(want)) != 0) {
+        uint64_t n = want.n_hidden ? want.n_params : want.n_inputs;
+        if (!bind_sections(n > core->n_features ? n : core->n_features))
+            return false;
+        // a fresh model: nothing of the old parameters or their moments carries over
+        uint64_t cap = 0;
+        stm_section("weights", &cap);
+        memset(weights, 0, cap);
+        memset(optim_m, 0, cap);
+        memset(optim_v, 0, cap);
+        memset(optim, 0, sizeof(*optim));
+        core->bias = 0.0;
+        if (want.n_hidden) {
+            rng_bulk_fill(rng_local_bulk(), weights, want.n_params);
+            mlp_init_params(&want, weights);
+        } else {
+            weights[0] = 0.1; // as in a fresh arena
+        }
+        *mlp = want;
+        if (want.n_hidden)
+            fprintf(stderr, "[agi] new mlp: %lu inputs, %lu hidden layers, %lu parameters\n",
+                    want.n_inputs, want.n_hidden, want.n_params);
+        else
+            fprintf(stderr, "[agi] back to the linear learner\n");
+        wal_resync();
+        stm_commit(MS_SYNC);
     }
-    return true;
+    return bind_scratch();
 }
 
-/* tiny forward: score = weight * x + bias */
-static double forward(double x) {
-    return stm->weight * x + stm->bias;
+/* shape the replay section for 'cfg' and the live feature count (a change clears it); nothing to
+   do with replay off */
+static bool bind_replay(const config_t* cfg) {
+    if (cfg->replay_capacity == 0)
+        return true;
+    uint64_t n = core->n_features; // read before the mapping can move
+    return replay_bind((uint64_t)cfg->replay_capacity, n) && bind_sections(n);
 }
 
-/* simple online update: delta rule */
-static void update_weights(double x, double reward, double lr) {
-    double pred = forward(x);
-    double error = reward - pred;
-    // gradient step: weight += lr * error * x
-    stm->weight += lr * error * x;
-    stm->bias += lr * error * 1.0;
-    stm->running_reward = 0.99 * stm->running_reward + 0.01 * reward;
-    msync(stm, sizeof(stm_t), MS_SYNC);
+/* --- policy hot reload --- */
+#define POLICY_SO "build/libagi_policy.so"
+
+static void* policy_handle = NULL;
+static unsigned policy_generation = 0;
+
+#ifdef AGI_STATIC
+#define LINKED_STATIC true // LINK=static in the Makefile
+#else
+#define LINKED_STATIC false
+#endif
+
+/* swap in the policy from 'so_path'. the current one stays active if anything goes wrong */
+static bool load_policy(const char* so_path) {
+#ifdef AGI_STATIC
+    // nothing can be loaded into a static binary: it runs the policy it was linked with
+    (void)policy_handle;
+    return false;
+#else
+    // dlopen caches by path and make rewrites it, so every generation loads a private copy
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.%d.%u", so_path, (int)getpid(), policy_generation + 1);
+    if (!build_copy_file(so_path, tmp)) {
+        unlink(tmp);
+        return false;
+    }
+    void* h = dlopen(tmp, RTLD_NOW | RTLD_LOCAL);
+    unlink(tmp); // the mapping keeps it alive
+    if (!h) {
+        fprintf(stderr, "[agi] dlopen: %s\n", dlerror());
+        return false;
+    }
+    const policy_api_t* (*get)(void);
+    *(void**)(&get) = dlsym(h, POLICY_SYMBOL);
+    const policy_api_t* api = get ? get() : NULL;
+    if (!api || api->abi != POLICY_ABI) {
+        fprintf(stderr, "[agi] %s: no usable %s (abi %u, want %u)\n", so_path, POLICY_SYMBOL,
+                api ? api->abi : 0, POLICY_ABI);
+        dlclose(h);
+        return false;
+    }
+    if (policy_handle)
+        dlclose(policy_handle);
+    policy_handle = h;
+    policy = api;
+    policy_generation++;
+    return true;
+#endif
 }
 
-/* self-recompile: run "make" and then exec this program again */
-static void recompile_and_exec(char* const argv0) {
-    fprintf(stderr, "[agi] triggering recompile\n");
+/* run make with the given target (NULL for the default), build profile and link, true if it
+   succeeded. make tracks header dependencies, so only what changed is rebuilt */
+static bool run_make(const char* target, const char* profile, const char* link) {
+    char profile_arg[64], link_arg[64];
+    snprintf(profile_arg, sizeof(profile_arg), "PROFILE=%s", profile);
+    snprintf(link_arg, sizeof(link_arg), "LINK=%s", link);
     pid_t pid = fork();
     if (pid == 0) {
-        execlp("make", "make", "-B", NULL);
+        if (target)
+            execlp("make", "make", profile_arg, link_arg, target, NULL);
+        else
+            execlp("make", "make", profile_arg, link_arg, NULL);
         _exit(127);
     }
     int status;
     waitpid(pid, &status, 0);
     if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
         fprintf(stderr, "[agi] make failed (status=%d)\n", WEXITSTATUS(status));
+        return false;
+    }
+    return true;
+}
+
+/* build key of the running generation, empty until one was built or fetched from the cache.
+   handed across exec in AGI_BUILD_KEY */
+static char live_key[BUILD_KEY_LEN] = "";
+
+/* hash the sources into 'key'; false means the running build already matches them (the
+   mutation only touched the config block, which is read at runtime) */
+static bool sources_changed(const char* profile, const char* link, char key[BUILD_KEY_LEN]) {
+    // the directory the binary was built from, wherever it is started from
+    char src_dir[4096] = "src";
+    const char* slash = strrchr(AGI_SOURCE_PATH, '/');
+    if (slash)
+        snprintf(src_dir, sizeof(src_dir), "%.*s", (int)(slash - AGI_SOURCE_PATH),
+                 AGI_SOURCE_PATH);
+    // a static build is keyed apart; a dynamic one keeps the keys it always had
+    char variant[64];
+    snprintf(variant, sizeof(variant), strcmp(link, "static") == 0 ? "%s-static" : "%s", profile);
+    if (!build_key(src_dir, variant, key)) {
+        key[0] = '\0'; // unhashable: always build, never cache
+        return true;
+    }
+    if (strcmp(key, live_key) != 0)
+        return true;
+    fprintf(stderr, "[agi] config-only mutation, build %s is current\n", key);
+    return false;
+}
+
+/* copy 'from' over 'to' by renaming a copy into place, so a running binary or a dlopen'd policy
+   never sees it half written */
+static bool install_file(const char* from, const char* to) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", to, (int)getpid());
+    if (!build_copy_file(from, tmp) || rename(tmp, to) != 0) {
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/* produce 'built' for 'key': from the build cache, or by running make and caching the result.
+   'path' receives where the artifact can be loaded from. 'also' (NULL for none) is a second
+   artifact of the same make run that must match it: it is cached with it and on a hit installed
+   over its built path, so a hit never pairs 'built' with another generation's 'also' */
+static bool build_artifact(const char* target, const char* profile, const char* link,
+                           const char* built, const char* also, const char* key, char* path,
+                           size_t len) {
+    char also_path[4096];
+    if (key[0] && build_cache_lookup(key, base_name(built), path, len) &&
+        (!also || build_cache_lookup(key, base_name(also), also_path, sizeof(also_path)))) {
+        if (also && !install_file(also_path, also)) {
+            perror("[agi] installing cached artifact");
+            return false;
+        }
+        fprintf(stderr, "[agi] build cache hit %s/%s\n", key, base_name(built));
+        restart_mark(RESTART_BUILT);
+        return true;
+    }
+    if (!run_make(target, profile, link))
+        return false;
+    restart_mark(RESTART_BUILT);
+    if (key[0] && (!build_cache_store(key, built) || (also && !build_cache_store(key, also))))
+        fprintf(stderr, "[agi] could not cache %s\n", built);
+    snprintf(path, len, "%s", built);
+    return true;
+}
+
+/* self-modify in place: rebuild only the policy and swap it in; STM, config and descriptors stay */
+static void recompile_and_reload(const char* profile) {
+    char key[BUILD_KEY_LEN], path[4096];
+    if (!sources_changed(profile, "dynamic", key))
+        return;
+    fprintf(stderr, "[agi] triggering %s policy rebuild\n", profile);
+    uint64_t t0 = now_ms();
+    if (!build_artifact(POLICY_SO, profile, "dynamic", POLICY_SO, NULL, key, path,
+                        sizeof(path)))
+        return;
+    if (!load_policy(path)) {
+        fprintf(stderr, "[agi] reload failed, keeping policy gen %u\n", policy_generation);
+        return;
+    }
+    snprintf(live_key, sizeof(live_key), "%s", key);
+    fprintf(stderr, "[agi] policy gen %u (%s) live after %lu ms\n", policy_generation,
+            policy->name, now_ms() - t0);
+}
+
+/* self-recompile: run "make" and then exec this program again with the same arguments */
+static void recompile_and_exec(char* const* argv, const char* profile, const char* link) {
+    const char* argv0 = argv[0];
+    char key[BUILD_KEY_LEN], path[4096];
+    if (!sources_changed(profile, link, key))
+        return;
+    fprintf(stderr, "[agi] triggering %s %s recompile\n", profile, link);
+    // a dynamic binary loads the policy built with it at startup
+    const char* policy_so = strcmp(link, "static") == 0 ? NULL : POLICY_SO;
+    if (!build_artifact(NULL, profile, link, argv0, policy_so, key, path, sizeof(path)))
+        return;
+    // a cached binary replaces ours the same way make would have
+    if (strcmp(path, argv0) != 0 && !install_file(path, argv0)) {
+        perror("[agi] installing cached binary");
         return;
     }
 
@@ -248,83 +501,507 @@ static void recompile_and_exec(char* const argv0) {
     }
 
     fprintf(stderr, "[agi] execing new binary %s\n", argv0);
-    execl(argv0, argv0, NULL);
+    wal_flush(true);
+    stm_commit(MS_SYNC);
+    evlog_stop();
+    if (key[0])
+        setenv("AGI_BUILD_KEY", key, 1);
+    watch_handoff();
+    restart_mark(RESTART_EXEC);
+    execv(argv0, argv);
     perror("execv");
+    watch_reclaim();
     exit(1);
 }
 
-/* utility: simple environment / toy task
-   task: predict parity-ish function of iter -> reward is 1 if action sign matches desired value
-*/
-static double toy_environment_reward(int iter, double action_value) {
-    // target function: reward if action_value sign matches ((iter % 10) < 5)
-    int target = (iter % 10) < 5 ? 1 : -1;
-    int act = (action_value >= 0) ? 1 : -1;
-    return (act == target) ? 1.0 : -1.0;
+/* set from SIGINT/SIGTERM so the loop can commit before exiting */
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_stop_signal(int sig) {
+    stop_requested = 1;
+}
+
+/* start or stop the write-ahead log as 'sync_mode' asks. opening it replays whatever the newest
+   commit is missing, which is nothing unless the last run crashed */
+static void bind_wal(int sync_mode) {
+    if (sync_mode != SYNC_WAL) {
+        wal_close();
+        return;
+    }
+    if (wal_is_open())
+        return;
+    uint64_t cap = 0;
+    stm_section("weights", &cap);
+    long replayed = wal_open(WAL_PATH, true, weights, cap / sizeof(double), core);
+    if (replayed > 0) {
+        fprintf(stderr, "[agi] wal: replayed %ld records, now at iter=%lu\n", replayed, core->iter);
+        stm_commit(MS_SYNC);
+    } else if (replayed < 0) {
+        fprintf(stderr, "[agi] wal: cannot open %s, committing as SYNC_MODE=interval\n", WAL_PATH);
+    }
+}
+
+static void write_scratch(void) {
+    snprintf(stats->scratch, sizeof(stats->scratch), "iter=%lu w0=%.6f b=%.6f rr=%.4f",
+             core->iter, weights[0], core->bias, core->running_reward);
+}
+
+/* --- population: score several candidate configs before committing to one --- */
+
+/* evaluate cur->population candidates (the incumbent plus mutants of it) in forked workers, each
+   on a copy-on-write snapshot of STM, and write the best one to the source. scored by
+   running_reward after eval_window iterations; the workers' learning is thrown away. returns
+   true if a mutant won and the source was rewritten */
+static bool evolve_population(const char* selfpath, const config_t* cur, double* phi) {
+    int k = cur->population;
+    config_t cand[POPULATION_MAX];
+    pid_t pids[POPULATION_MAX];
+    cand[0] = *cur;
+    for (int i = 1; i < k; i++)
+        cand[i] = mutate_config(cur);
+
+    double* score = mmap(NULL, (size_t)k * sizeof(double), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (score == MAP_FAILED) {
+        perror("mmap(scores)");
+        return false;
+    }
+    uint64_t t0 = now_ms();
+    for (int i = 0; i < k; i++) {
+        score[i] = -HUGE_VAL;
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            perror("fork(evaluator)");
+        } else if (pids[i] == 0) {
+            if (!stm_make_private())
+                _exit(1);
+            pool_forked();
+            rng_branch((uint64_t)i + 1);
+            for (int n = 0; n < cand[i].eval_window && !stop_requested; n++) {
+                loop_learn_one(policy, &pctx, &cand[i], phi, core->iter);
+                core->iter++;
+            }
+            score[i] = core->running_reward;
+            _exit(0);
+        }
+    }
+    for (int i = 0; i < k; i++) {
+        if (pids[i] > 0)
+            waitpid(pids[i], NULL, 0);
+    }
+
+    // ties go to the incumbent, so only a strictly better mutant costs a rebuild
+    int best = 0;
+    for (int i = 1; i < k; i++) {
+        if (score[i] > score[best])
+            best = i;
+    }
+    fprintf(stderr,
+            "[agi] population of %d scored in %lu ms: incumbent rr=%.4f, best #%d rr=%.4f "
+            "lr=%.4f mp=%.4f int=%d\n",
+            k, now_ms() - t0, score[0], best, score[best], cand[best].learning_rate,
+            cand[best].mutation_prob, cand[best].recompile_interval);
+    munmap(score, (size_t)k * sizeof(double));
+    if (best == 0 || stop_requested)
+        return false;
+    return write_source_config(selfpath, &cand[best]);
+}
+
+/* publish the block as it now stands in the source and bring the build up to it: reload the
+   policy, or exec the new binary (which only returns if that failed) */
+static void rebuild(const char* selfpath, char* const* argv, const config_t* cfg) {
+    // publish first, so an exec'd generation finds the sidecar already current
+    config_compile(selfpath);
+    const char* profile = build_profile_names[cfg->build_profile];
+    // a static binary cannot take a policy in, and a dynamic one cannot turn static in place
+    if (cfg->reload_mode == RELOAD_DLOPEN && cfg->build_link == LINK_DYNAMIC && !LINKED_STATIC)
+        recompile_and_reload(profile);
+    else
+        recompile_and_exec(argv, profile, build_link_names[cfg->build_link]);
+}
+
+/* --- hogwild: more learner processes on the same arena --- */
+
+static pid_t hogwild_pids[WORKERS_MAX];
+static int hogwild_running = 0; // forked workers, the loop itself not counted
+
+/* claim 'n' consecutive iterations of the shared counter, returns the first */
+static uint64_t claim_iterations(uint64_t n) {
+    return __atomic_fetch_add(&core->iter, n, __ATOMIC_RELAXED);
+}
+
+/* whether a multiple of k lies in (prev, it]: the same as it % k == 0 for a loop that sees every
+   iteration, without missing a beat when workers claim some of them */
+static bool crossed(uint64_t prev, uint64_t it, uint64_t k) {
+    return it / k != prev / k;
+}
+
+/* a worker's whole life: claim the next iteration, learn from it and race the other processes on
+   the weights without locks. every weight is an aligned double, so a racing store can lose an
+   update but never tear one. ends on SIGTERM or when the loop's process goes away */
+static void hogwild_worker(const config_t* cfg, int w, double* phi, pid_t parent) {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != parent)
+        _exit(0);
+    pool_forked();
+    rng_branch(POPULATION_MAX + (uint64_t)w);
+    config_t own = *cfg;
+    own.replay_capacity = 0; // the ring has a single writer, the loop
+    tick_t tick;
+    tick_init(&tick, own.tick_mode, own.tick_hz);
+    while (!stop_requested) {
+        loop_learn_one(policy, &pctx, &own, phi, claim_iterations(1));
+        tick_wait(&tick);
+    }
+    _exit(0);
+}
+
+/* fork cfg->workers - 1 workers. they share the live sections with the loop, so they must be
+   stopped before anything can move the mapping, reload the policy or exec */
+static void hogwild_start(const config_t* cfg, double* phi) {
+    pid_t parent = getpid();
+    uint64_t from = core->iter;
+    for (int w = 1; w < cfg->workers; w++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork(hogwild)");
+            break;
+        }
+        if (pid == 0)
+            hogwild_worker(cfg, w, phi, parent);
+        hogwild_pids[hogwild_running++] = pid;
+    }
+    fprintf(stderr, "[agi] %d hogwild workers started at iter=%lu\n", hogwild_running, from);
+}
+
+static void hogwild_stop(void) {
+    for (int i = 0; i < hogwild_running; i++)
+        kill(hogwild_pids[i], SIGTERM);
+    for (int i = 0; i < hogwild_running; i++)
+        waitpid(hogwild_pids[i], NULL, 0);
+    hogwild_running = 0;
+}
+
+/* --- rollback: every mutation is on trial for eval_window iterations --- */
+
+/* what the loop keeps with a snapshot (snapshot.h): a file next to it, so a verdict still pending
+   when the generation execs is picked up by the next one */
+typedef struct {
+    uint64_t iter;   // the mutation's iteration
+    uint64_t due;    // when the verdict is in
+    double baseline; // running_reward when the snapshot was taken
+    config_t config; // the block the mutation started from
+} rollback_t;
+
+static rollback_t rollback;
+static bool rollback_pending = false;
+
+/* snapshot the arena before the generation mutated from 'block' takes over. the workers must be
+   stopped */
+static void rollback_arm(const config_t* cfg, const config_t* block, uint64_t it) {
+    if (cfg->snapshot == SNAPSHOT_OFF)
+        return;
+    rollback = (rollback_t){it, it + (uint64_t)cfg->eval_window, core->running_reward, *block};
+    snapshot_stats_t st;
+    rollback_pending = snapshot_take(cfg->snapshot, STM_PATH, &rollback, sizeof(rollback), &st);
+    if (!rollback_pending) {
+        fprintf(stderr, "[agi] snapshot failed, this mutation cannot be rolled back\n");
+        return;
+    }
+    if (st.reflinked)
+        fprintf(stderr, "[agi] snapshot reflinked in %lu us\n", st.micros);
+    else
+        fprintf(stderr, "[agi] snapshot diffed %lu/%lu pages in %lu us\n", st.pages, st.total,
+                st.micros);
+}
+
+/* the verdict on the generation on trial: kept if running_reward held up over its window, else
+   the durable sections go back to the snapshot (only the pages that changed are written) and
+   the old block back into the source. returns true if it was rolled back */
+static bool rollback_judge(const char* selfpath, char* const* argv, const config_t* cfg) {
+    rollback_pending = false;
+    double rr = core->running_reward;
+    if (rr >= rollback.baseline) {
+        fprintf(stderr, "[agi] mutation at iter=%lu kept: rr %.4f -> %.4f\n", rollback.iter,
+                rollback.baseline, rr);
+        stats->mutations++;
+        snapshot_drop(STM_PATH);
+        return false;
+    }
+    stats->rollbacks++;
+    hogwild_stop();
+    // the counter stays monotonic: iterations since the snapshot were run, even if undone. so
+    // does the log, whose next record holds the restored parameters whole
+    uint64_t iter = core->iter;
+    stm_wal_t* log = stm_section("wal", NULL);
+    stm_wal_t logged = *log;
+    snapshot_stats_t st;
+    if (snapshot_restore(STM_PATH, &st)) {
+        core->iter = iter;
+        *log = logged;
+        wal_resync();
+        stm_commit(MS_SYNC);
+        fprintf(stderr,
+                "[agi] mutation at iter=%lu rolled back: rr %.4f -> %.4f, restored %lu/%lu pages "
+                "in %lu us\n",
+                rollback.iter, rollback.baseline, rr, st.pages, st.total, st.micros);
+    } else {
+        // the arena was reshaped since (FEATURES, MLP_HIDDEN, ...); the config alone goes back
+        fprintf(stderr, "[agi] mutation at iter=%lu rolled back (config only, the arena changed "
+                        "shape): rr %.4f -> %.4f\n",
+                rollback.iter, rollback.baseline, rr);
+    }
+    snapshot_drop(STM_PATH);
+    restart_begin();
+    if (write_source_config(selfpath, &rollback.config)) {
+        rebuild(selfpath, argv, cfg);
+    } else {
+        restart_cancel();
+        fprintf(stderr, "[agi] could not write the old config back\n");
+    }
+    return true;
 }
 
 /* main loop */
 int main(int argc, char** argv) {
-    srand((unsigned)time(NULL) ^ (unsigned)getpid());
+    restart_mark(RESTART_MAIN);
+    watch_adopt();
+    const char* decode = argc == 2 ? config_value(argv[1], "--decode=") : NULL;
+    if (decode)
+        return evlog_decode(decode, stdout) ? 0 : 1;
+    decode = argc == 2 ? config_value(argv[1], "--decode-wal=") : NULL;
+    if (decode)
+        return wal_decode(decode, stdout) ? 0 : 1;
+    struct sigaction sa = {0};
+    sa.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
 
-    if (!map_stm_file(STM_PATH))
-        return 1;
+    const char* inherited_key = getenv("AGI_BUILD_KEY");
+    if (inherited_key)
+        snprintf(live_key, sizeof(live_key), "%s", inherited_key);
+
+    vec_init();
+    env_init();
+    gemm_init();
+    if (load_policy(POLICY_SO)) {
+        fprintf(stderr, "[agi] loaded policy %s from %s\n", policy->name, POLICY_SO);
+    } else {
+        policy = agi_policy();
+        fprintf(stderr, "[agi] using built-in policy %s\n", policy->name);
+    }
+    // the source make compiles, not the binary: config is read from and mutations written to it
     char selfpath[4096] = {0};
-    if (readlink("/proc/self/exe", selfpath, sizeof(selfpath) - 1) <= 0) {
-        // fallback: argv[0]
-        strncpy(selfpath, argv[0], sizeof(selfpath) - 1);
+    bool have_source =
+            locate_source(argc, argv, AGI_SOURCE_PATH, AGI_SOURCE_CKSUM, selfpath, sizeof(selfpath));
+    if (!have_source)
+        fprintf(stderr, "[agi] no source with a config block found (--source=PATH or "
+                        "AGI_SOURCE), running on defaults without mutation\n");
+
+    // the config block of our own source, compiled into the sidecar unless it already is
+    if (!config_bin_open(CONFIG_BIN_PATH, selfpath))
+        return 1;
+    uint64_t config_gen = 0;
+    config_t cfg = config_load(&config_gen);
+    bool watching = have_source && watch_config(selfpath);
+    if (!have_source)
+        watch_drop();
+    if (!apply_cli_overrides(&cfg, argc, argv)) {
+        fprintf(stderr,
+                "usage: %s [--tick-mode=free|fixed|adaptive] [--tick-hz=HZ] [--iterations=N] "
+                "[--no-mutate] [--source=PATH]\n       %s --decode=EVLOG_FILE\n"
+                "       %s --decode-wal=WAL_FILE\n",
+                argv[0], argv[0], argv[0]);
+        return 2;
     }
+    restart_mark(RESTART_CONFIG);
+    // the mapping is tuned as it is made: MAP_POPULATE only helps at mmap time
+    tune_stm(&cfg);
+    if (!map_stm_file(STM_PATH))
+        return 1;
+    // a crash's lost iterations first: the rng and everything below pick up where they ended
+    bind_wal(cfg.sync_mode);
+    rng_init(cfg.seed, core->iter);
+    if (!evlog_start(cfg.evlog))
+        cfg.evlog = EVLOG_OFF;
+    if (!pool_start((size_t)cfg.threads))
+        cfg.threads = 1;
+    pctx.deterministic = cfg.deterministic;
+    if (!bind_model(&cfg) || !bind_replay(&cfg))
+        return 1;
+    restart_mark(RESTART_MAPPED);
+    rollback_pending = snapshot_meta(STM_PATH, &rollback, sizeof(rollback));
+    if (rollback_pending)
+        fprintf(stderr, "[agi] mutation at iter=%lu on trial until iter=%lu\n", rollback.iter,
+                rollback.due);
 
-    // read config from our own source file
-    config_t cfg = read_config_from_source(selfpath);
-    // (if parse failed, fall back to defaults)
-    if (cfg.recompile_interval <= 0)
-        cfg.recompile_interval = config_defaults.recompile_interval;
+    report_stm();
+    fprintf(stderr,
+            "[agi] start iter=%lu features=%lu (%s) bias=%.6f lr=%.4f mp=%.4f int=%d sync=%s "
+            "seq=%lu tick=%s@%gHz batch=%d (%s) config=%s evlog=%s seed=%lu replay=%lu/%d "
+            "optim=%s*%d model=%s (gemm %s) threads=%zu%s\n",
+            core->iter, core->n_features, vec->name, core->bias, cfg.learning_rate,
+            cfg.mutation_prob, cfg.recompile_interval, sync_mode_names[cfg.sync_mode], stm->seq,
+            tick_mode_names[cfg.tick_mode], cfg.tick_hz, cfg.batch, env_kernel(),
+            watching ? "watched" : "polled", evlog_mode_names[cfg.evlog], rng_seed_used(),
+            replay_count(), cfg.replay_capacity, optimizer_names[cfg.optimizer], cfg.epochs,
+            mlp->n_hidden ? "mlp" : "linear", gemm_kernel(), pool_threads(),
+            cfg.deterministic ? " (deterministic)" : "");
 
-    fprintf(stderr, "[agi] start iter=%lu weight=%.6f bias=%.6f lr=%.4f mp=%.4f int=%d\n",
-            stm->iter, stm->weight, stm->bias, cfg.learning_rate, cfg.mutation_prob,
-            cfg.recompile_interval);
+    tick_t tick;
+    tick_init(&tick, cfg.tick_mode, cfg.tick_hz);
 
+    // rewards are computed a batch ahead and consumed one per iteration
+    loop_t loop;
+    if (!loop_init(&loop, &pctx, (size_t)cfg.batch)) {
+        perror("env_batch_init");
+        return 1;
+    }
+    // whether the batch was claimed from the shared counter at once (with hogwild workers
+    // running) rather than counted up one step at a time
+    bool batch_claimed = false;
+    uint64_t prev_it = core->iter - 1;
+    uint64_t overruns_seen = 0;
+    uint64_t iterations_run = 0;
     for (;;) {
-        // simple perception: scalar input is iter % 10 normalized
-        int it = (int)stm->iter;
-        double x = (double)(it % 10) - 4.5; // in approx [-4.5, 5.5]
-        double out = forward(x);
-        // act: sign of out
-        double reward = toy_environment_reward(it, out);
-        // learn online
-        update_weights(x, reward, cfg.learning_rate);
-
-        // write a human-readable scratch for observation
-        snprintf(stm->scratch, sizeof(stm->scratch), "iter=%lu w=%.6f b=%.6f rr=%.4f", stm->iter,
-                 stm->weight, stm->bias, stm->running_reward);
-        msync(stm, sizeof(stm_t), MS_SYNC);
-
-        if ((stm->iter % 100) == 0) {
-            fprintf(stderr, "[agi] %s\n", stm->scratch);
+        if (loop_drained(&loop)) {
+            batch_claimed = hogwild_running > 0;
+            uint64_t base = batch_claimed ? claim_iterations(loop.env.cap) : core->iter;
+            if (!loop_refill(&loop, policy, base))
+                return 1;
+        }
+        uint64_t it = loop_learn(&loop, policy, &cfg);
+        if (crossed(prev_it, it, 100)) {
+            stats->overruns += tick.overruns - overruns_seen;
+            overruns_seen = tick.overruns;
+            evlog_push(EV_STATUS, it, weights[0], core->bias, core->running_reward,
+                       (double)tick.overruns, (double)tick.ticks);
+            // the human-readable scratch for observation, as of the last status point
+            write_scratch();
         }
 
+        // the last mutation's trial is over: keep it, or roll the arena and the block back
+        if (have_source && !cfg.no_mutate && rollback_pending && it >= rollback.due &&
+            rollback_judge(selfpath, argv, &cfg))
+            loop_discard(&loop);
+
         // self-mod: occasionally mutate source then rebuild+exec
-        if ((stm->iter > 0) && ((stm->iter % cfg.recompile_interval) == 0)) {
-            double r = rand() / (double)RAND_MAX;
-            if (r < cfg.mutation_prob) {
+        if (have_source && !cfg.no_mutate && it > 0 &&
+            crossed(prev_it, it, (uint64_t)cfg.recompile_interval)) {
+            double r = rng_uniform(rng_local());
+            // one generation on trial at a time: no mutation until its verdict is in
+            bool mutate = r < cfg.mutation_prob && !rollback_pending;
+            bool mutated = false;
+            // the workers would race the population's snapshot, the rebuild and the exec
+            if (mutate) {
+                restart_begin();
+                hogwild_stop();
+            }
+            // mutants derive from the block itself, so command line overrides never leak into it
+            config_t block = config_load(NULL);
+            if (mutate && cfg.population > 1) {
+                mutated = evolve_population(selfpath, &block, loop.phi);
+                if (!mutated) {
+                    restart_cancel();
+                    fprintf(stderr, "[agi] no candidate promoted\n");
+                }
+            } else if (mutate) {
                 fprintf(stderr, "[agi] mutating source (prob %.3f)\n", cfg.mutation_prob);
-                if (mutate_source_config(selfpath, cfg.mutation_prob)) {
-                    fprintf(stderr, "[agi] source mutated; recompiling\n");
-                    recompile_and_exec(argv[0]);
-                    // exec replaces process on success; if it returns, continue
-                } else {
+                mutated = mutate_source_config(selfpath, &block);
+                if (!mutated) {
+                    restart_cancel();
                     fprintf(stderr, "[agi] mutate_source_config failed\n");
                 }
-            } else {
-                fprintf(stderr, "[agi] chose not to mutate this cycle (r=%.3f)\n", r);
+            } else if (r >= cfg.mutation_prob) {
+                evlog_push(EV_SKIP, it, weights[0], core->bias, core->running_reward, r, 0);
             }
-            // re-read config in case mutation didn't exec (or if no mutation)
-            cfg = read_config_from_source(selfpath);
+            if (mutated) {
+                rollback_arm(&cfg, &block, it);
+                fprintf(stderr, "[agi] source mutated; recompiling\n");
+                rebuild(selfpath, argv, &cfg);
+                // the prefetched steps came from the old policy
+                loop_discard(&loop);
+            } else if (!watching) {
+                // pick up hand edits of the block; only a stat unless it changed
+                config_refresh(selfpath);
+            }
+        }
+
+        // the config only changes with a new sidecar generation, so this is a single load
+        if (config_generation() != config_gen) {
+            // the sections may move below
+            hogwild_stop();
+            config_t next = config_load(&config_gen);
+            apply_cli_overrides(&next, argc, argv);
+            if (next.seed != cfg.seed)
+                rng_init(next.seed, core->iter);
+            if (next.evlog != cfg.evlog) {
+                evlog_stop();
+                if (!evlog_start(next.evlog))
+                    next.evlog = EVLOG_OFF;
+            }
+            if (next.tick_mode != cfg.tick_mode || next.tick_hz != cfg.tick_hz)
+                tick_init(&tick, next.tick_mode, next.tick_hz);
+            if (next.sync_mode != cfg.sync_mode)
+                bind_wal(next.sync_mode);
+            if (next.stm_hugepages != cfg.stm_hugepages || next.stm_lock != cfg.stm_lock ||
+                next.stm_prefault != cfg.stm_prefault) {
+                tune_stm(&next);
+                report_stm();
+            }
+            if (next.threads != cfg.threads) {
+                if (!pool_start((size_t)next.threads))
+                    next.threads = 1;
+                if (!bind_scratch())
+                    return 1;
+            }
+            pctx.deterministic = next.deterministic;
+            bool reshape = next.features != cfg.features || next.mlp_layers != cfg.mlp_layers ||
+                           next.mlp_activation != cfg.mlp_activation ||
+                           memcmp(next.mlp_width, cfg.mlp_width, sizeof(cfg.mlp_width)) != 0;
+            if (reshape && !bind_model(&next)) {
+                next.features = cfg.features;
+                next.mlp_layers = cfg.mlp_layers;
+                memcpy(next.mlp_width, cfg.mlp_width, sizeof(cfg.mlp_width));
+                next.mlp_activation = cfg.mlp_activation;
+            }
+            if ((next.features != cfg.features || next.replay_capacity != cfg.replay_capacity) &&
+                !bind_replay(&next))
+                next.replay_capacity = 0;
+            if (next.batch != cfg.batch && !loop_resize(&loop, (size_t)next.batch)) {
+                perror("env_batch_init");
+                return 1;
+            }
+            // prefetched steps are stale once the feature count changed
+            if (next.features != cfg.features)
+                loop_discard(&loop);
+            cfg = next;
         }
 
-        stm->iter++;
-        usleep(100000); // 100ms tick
+        if (!batch_claimed)
+            core->iter++;
+        prev_it = it;
+        if (cfg.workers > 1 && hogwild_running == 0 && !stop_requested) {
+            hogwild_start(&cfg, loop.phi);
+            // the rest of the batch was counted, not claimed: the workers own those steps now
+            loop_discard(&loop);
+        }
+        loop_commit(&loop, &cfg);
+        char line[256];
+        if (restart_finish(line, sizeof(line)))
+            fprintf(stderr, "[agi] %s\n", line);
+        if (stop_requested || (cfg.max_iterations && ++iterations_run >= cfg.max_iterations)) {
+            hogwild_stop();
+            write_scratch();
+            wal_close();
+            stm_commit(MS_SYNC);
+            evlog_stop();
+            pool_stop();
+            fprintf(stderr, "[agi] stopping at iter=%lu (seq=%lu) overruns=%lu/%lu\n", core->iter,
+                    stm->seq, tick.overruns, tick.ticks);
+            return 0;
+        }
+        tick_wait(&tick);
     }
 
     return 0;
@@ -0,0 +1,465 @@
+#define _GNU_SOURCE
+#include "migrate.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "state.h"
+#include "stm.h"
+
+typedef struct {
+    const char* name;
+    uint64_t offset;
+    uint64_t size;
+} field_desc_t;
+
+typedef struct {
+    const field_desc_t* fields;
+    size_t n_fields;
+    uint64_t size; // bytes the whole layout occupies
+} layout_t;
+
+#define LAYOUT(fields, size) {fields, sizeof(fields) / sizeof(fields[0]), size}
+
+/* --- arena sections, one descriptor table per layout version. these are history: never edit a
+   table once it has shipped, add a new one and bump the *_LAYOUT constant instead --- */
+static const field_desc_t core_v0[] = {
+        {"iter", 0, 8},
+        {"n_features", 8, 8},
+        {"bias", 16, 8},
+        {"running_reward", 24, 8},
+};
+static const layout_t core_layouts[] = {LAYOUT(core_v0, 32)};
+
+static const field_desc_t optim_v0[] = {
+        {"steps", 0, 8},
+        {"bias_m", 8, 8},
+        {"bias_v", 16, 8},
+};
+static const layout_t optim_layouts[] = {LAYOUT(optim_v0, 32)};
+
+static const field_desc_t mlp_v0[] = {
+        {"n_hidden", 0, 8},
+        {"n_inputs", 8, 8},
+        {"width", 16, 32},
+        {"activation", 48, 8},
+        {"n_params", 56, 8},
+};
+static const layout_t mlp_layouts[] = {LAYOUT(mlp_v0, 64)};
+
+static const field_desc_t stats_v0[] = {
+        {"overruns", 0, 8},
+        {"scratch", 8, 256},
+};
+static const field_desc_t stats_v1[] = {
+        {"overruns", 0, 8},
+        {"mutations", 8, 8},
+        {"rollbacks", 16, 8},
+        {"scratch", 24, 256},
+};
+static const layout_t stats_layouts[] = {LAYOUT(stats_v0, 264), LAYOUT(stats_v1, 280)};
+
+static const field_desc_t wal_v0[] = {
+        {"lsn", 0, 8},
+        {"offset", 8, 8},
+};
+static const layout_t wal_layouts[] = {LAYOUT(wal_v0, 32)};
+
+static const field_desc_t restart_v0[] = {
+        {"stamp", 0, 56},
+        {"pending", 56, 8},
+        {"cycles", 64, 8},
+        {"sum", 72, 56},
+};
+static const layout_t restart_layouts[] = {LAYOUT(restart_v0, 128)};
+
+_Static_assert(sizeof(core_layouts) / sizeof(core_layouts[0]) == CORE_LAYOUT + 1,
+               "core layout changed: add a descriptor table");
+_Static_assert(sizeof(stm_core_t) == 32 && offsetof(stm_core_t, running_reward) == 24,
+               "stm_core_t no longer matches its newest descriptor table");
+_Static_assert(sizeof(optim_layouts) / sizeof(optim_layouts[0]) == OPTIM_LAYOUT + 1,
+               "optim layout changed: add a descriptor table");
+_Static_assert(sizeof(stm_optim_t) == 32 && offsetof(stm_optim_t, bias_v) == 16,
+               "stm_optim_t no longer matches its newest descriptor table");
+_Static_assert(sizeof(mlp_layouts) / sizeof(mlp_layouts[0]) == MLP_LAYOUT + 1,
+               "mlp layout changed: add a descriptor table");
+_Static_assert(sizeof(stm_mlp_t) == 64 && offsetof(stm_mlp_t, n_params) == 56,
+               "stm_mlp_t no longer matches its newest descriptor table");
+_Static_assert(sizeof(stats_layouts) / sizeof(stats_layouts[0]) == STATS_LAYOUT + 1,
+               "stats layout changed: add a descriptor table");
+_Static_assert(sizeof(stm_stats_t) == 280 && offsetof(stm_stats_t, scratch) == 24,
+               "stm_stats_t no longer matches its newest descriptor table");
+_Static_assert(sizeof(wal_layouts) / sizeof(wal_layouts[0]) == WAL_LAYOUT + 1,
+               "wal layout changed: add a descriptor table");
+_Static_assert(sizeof(stm_wal_t) == 32 && offsetof(stm_wal_t, offset) == 8,
+               "stm_wal_t no longer matches its newest descriptor table");
+_Static_assert(sizeof(restart_layouts) / sizeof(restart_layouts[0]) == RESTART_LAYOUT + 1,
+               "restart layout changed: add a descriptor table");
+_Static_assert(sizeof(stm_restart_t) == 128 && offsetof(stm_restart_t, sum) == 72,
+               "stm_restart_t no longer matches its newest descriptor table");
+
+typedef struct {
+    const char* name;
+    const layout_t* layouts;
+    uint64_t current;
+    unsigned flags;
+} section_schema_t;
+
+static const section_schema_t schemas[] = {
+        {"core", core_layouts, CORE_LAYOUT, STM_DURABLE},
+        {"optim", optim_layouts, OPTIM_LAYOUT, STM_DURABLE},
+        {"mlp", mlp_layouts, MLP_LAYOUT, STM_DURABLE},
+        {"stats", stats_layouts, STATS_LAYOUT, 0},
+        {"wal", wal_layouts, WAL_LAYOUT, STM_DURABLE},
+        {"restart", restart_layouts, RESTART_LAYOUT, 0},
+};
+
+/* --- flat stm_t before the arena, by STM_VERSION. the weight vector maps onto the "weights"
+   section; before version 3 it was a single scalar weight --- */
+static const field_desc_t flat_v1[] = {
+        {"iter", 16, 8},
+        {"weights", 24, 8},
+        {"bias", 32, 8},
+        {"running_reward", 40, 8},
+        {"scratch", 48, 256},
+};
+static const field_desc_t flat_v3[] = {
+        {"iter", 16, 8},
+        {"n_features", 24, 8},
+        {"bias", 32, 8},
+        {"running_reward", 40, 8},
+        {"scratch", 48, 256},
+        {"weights", 320, 1024 * 8},
+};
+// version 2 only appended commit slots to version 1
+static const layout_t flat_layouts[] = {LAYOUT(flat_v1, 304), LAYOUT(flat_v1, 408),
+                                        LAYOUT(flat_v3, 25024)};
+
+/* their two commit slots, from version 2 on: the fields of a slot and where the first one starts
+   (the second follows it). the checksum is a bytewise fnv-1a over the fields before it and, from
+   version 3, the first n_features weights after it */
+static const field_desc_t flat_commit_v2[] = {
+        {"seq", 0, 8},
+        {"iter", 8, 8},
+        {"weights", 16, 8},
+        {"bias", 24, 8},
+        {"running_reward", 32, 8},
+        {"checksum", 40, 8},
+};
+static const field_desc_t flat_commit_v3[] = {
+        {"seq", 0, 8},
+        {"iter", 8, 8},
+        {"n_features", 16, 8},
+        {"bias", 24, 8},
+        {"running_reward", 32, 8},
+        {"checksum", 40, 8},
+        {"weights", 48, 1024 * 8},
+};
+static const layout_t flat_commit_layouts[] = {{NULL, 0, 0}, LAYOUT(flat_commit_v2, 48),
+                                               LAYOUT(flat_commit_v3, 8240)};
+static const uint64_t flat_commit_offsets[] = {0, 312, 8512};
+
+/* --- the arena's own header before STM_VERSION 5, when commits did not record the layouts of
+   the sections they held and checksummed the whole shadow copies --- */
+#define ARENA_V4 4
+typedef struct {
+    char name[STM_NAME_LEN];
+    uint64_t offset;
+    uint64_t size;
+    uint64_t shadow[2];
+    uint64_t flags;
+    uint64_t layout;
+} arena_v4_section_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t file_size;
+    uint64_t used;
+    uint64_t seq;
+    uint64_t n_sections;
+    uint64_t commit[2][2]; // seq, checksum
+    arena_v4_section_t sections[STM_MAX_SECTIONS];
+} arena_v4_t;
+
+_Static_assert(sizeof(arena_v4_t) == 1104, "arena_v4_t must match the version 4 header");
+
+static const field_desc_t* find_field(const layout_t* l, const char* name) {
+    for (size_t i = 0; i < l->n_fields; i++) {
+        if (strcmp(l->fields[i].name, name) == 0)
+            return &l->fields[i];
+    }
+    return NULL;
+}
+
+/* fill 'dst' (zeroed first) from 'src' field by field; 'src_len' bounds reads from 'src' */
+static void copy_fields(void* dst, const layout_t* to, const void* src, const layout_t* from,
+                        uint64_t src_len) {
+    memset(dst, 0, to->size);
+    for (size_t i = 0; i < to->n_fields; i++) {
+        const field_desc_t* d = &to->fields[i];
+        const field_desc_t* s = find_field(from, d->name);
+        if (!s || s->offset + s->size > src_len)
+            continue;
+        memcpy((char*)dst + d->offset, (const char*)src + s->offset,
+               d->size < s->size ? d->size : s->size);
+    }
+}
+
+static uint64_t flat_hash(uint64_t h, const unsigned char* p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t flat_u64(const unsigned char* p, const field_desc_t* f) {
+    uint64_t v;
+    memcpy(&v, p + f->offset, sizeof(v));
+    return v;
+}
+
+/* the newest commit slot of a flat file of 'version' that still checksums, NULL if it has no
+   slots or none holds */
+static const unsigned char* flat_commit(uint64_t version, const unsigned char* old) {
+    const layout_t* l = &flat_commit_layouts[version - 1];
+    if (!l->fields)
+        return NULL;
+    const field_desc_t* seq = find_field(l, "seq");
+    const field_desc_t* check = find_field(l, "checksum");
+    const field_desc_t* nf = find_field(l, "n_features");
+    const field_desc_t* w = find_field(l, "weights");
+    const unsigned char* best = NULL;
+    for (int c = 0; c < 2; c++) {
+        const unsigned char* slot = old + flat_commit_offsets[version - 1] + c * l->size;
+        uint64_t h = flat_hash(STM_HASH_SEED, slot, check->offset);
+        if (nf) {
+            uint64_t n = flat_u64(slot, nf);
+            if (n > w->size / sizeof(double))
+                continue;
+            h = flat_hash(h, slot + w->offset, n * sizeof(double));
+        }
+        if (flat_u64(slot, seq) == 0 || h != flat_u64(slot, check))
+            continue;
+        if (!best || flat_u64(slot, seq) > flat_u64(best, seq))
+            best = slot;
+    }
+    return best;
+}
+
+void stm_stamp_layouts(void) {
+    for (size_t i = 0; i < sizeof(schemas) / sizeof(schemas[0]); i++)
+        stm_set_layout(schemas[i].name, schemas[i].current);
+}
+
+bool stm_upgrade_sections(void) {
+    bool upgraded = false;
+    for (size_t i = 0; i < sizeof(schemas) / sizeof(schemas[0]); i++) {
+        const section_schema_t* sc = &schemas[i];
+        uint64_t size;
+        void* p = stm_section(sc->name, &size);
+        uint64_t from = stm_layout(sc->name);
+        if (!p || from == sc->current)
+            continue;
+        if (from > sc->current) {
+            fprintf(stderr, "[agi] stm: section '%s' has layout %lu, this binary knows up to %lu\n",
+                    sc->name, from, sc->current);
+            return false;
+        }
+        unsigned char* old = malloc(size);
+        if (!old)
+            return false;
+        memcpy(old, p, size);
+        const layout_t* to = &sc->layouts[sc->current];
+        void* q = stm_reserve(sc->name, to->size, sc->flags);
+        if (!q) {
+            free(old);
+            return false;
+        }
+        copy_fields(q, to, old, &sc->layouts[from], size);
+        free(old);
+        stm_set_layout(sc->name, sc->current);
+        fprintf(stderr, "[agi] stm: upgraded section '%s' layout %lu -> %lu\n", sc->name, from,
+                sc->current);
+        upgraded = true;
+    }
+    if (upgraded)
+        stm_commit(MS_SYNC);
+    return true;
+}
+
+/* the newest commit of a version 4 arena that still checksums, -1 if there is none */
+static int arena_v4_commit(const arena_v4_t* h, const unsigned char* base, uint64_t size) {
+    if (h->n_sections > STM_MAX_SECTIONS || h->used > size)
+        return -1;
+    for (uint64_t i = 0; i < h->n_sections; i++) {
+        const arena_v4_section_t* s = &h->sections[i];
+        uint64_t copies = (s->flags & STM_DURABLE) ? 3 : 1;
+        if (s->offset + s->size * copies > h->used)
+            return -1;
+    }
+    int k = -1;
+    for (int c = 0; c < 2; c++) {
+        uint64_t seq = h->commit[c][0];
+        uint64_t sum = stm_hash(STM_HASH_SEED, &seq, sizeof(seq));
+        for (uint64_t i = 0; i < h->n_sections; i++) {
+            const arena_v4_section_t* s = &h->sections[i];
+            if (!(s->flags & STM_DURABLE))
+                continue;
+            sum = stm_hash(sum, s->name, STM_NAME_LEN);
+            sum = stm_hash(sum, &s->size, sizeof(s->size));
+            sum = stm_hash(sum, base + s->shadow[c], s->size);
+        }
+        if (seq != 0 && sum == h->commit[c][1] && (k < 0 || seq > h->commit[k][0]))
+            k = c;
+    }
+    return k;
+}
+
+/* rebuild a version 4 arena from its newest commit under the current header: the new one is
+   larger, so it cannot be rewritten in place */
+static bool migrate_arena_v4(const char* path, int fd, uint64_t size) {
+    unsigned char* base = size >= sizeof(arena_v4_t)
+                                  ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)
+                                  : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "[agi] stm: cannot read version %d arena for migration\n", ARENA_V4);
+        return false;
+    }
+    const arena_v4_t* h = (const arena_v4_t*)base;
+    int k = arena_v4_commit(h, base, size);
+    if (k < 0) {
+        munmap(base, size);
+        return true; // nothing worth keeping; stm_open() starts afresh
+    }
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.migrate", path);
+    unlink(tmp_path);
+    bool ok = stm_open(tmp_path) == STM_FRESH;
+    for (uint64_t i = 0; ok && i < h->n_sections; i++) {
+        const arena_v4_section_t* s = &h->sections[i];
+        bool durable = (s->flags & STM_DURABLE) != 0;
+        void* p = stm_reserve(s->name, s->size, (unsigned)s->flags);
+        if (p) {
+            memcpy(p, base + (durable ? s->shadow[k] : s->offset), s->size);
+            stm_set_layout(s->name, s->layout);
+        }
+        ok = p != NULL;
+    }
+    if (ok) {
+        stm->seq = h->commit[k][0];
+        stm_commit(MS_SYNC);
+        fprintf(stderr, "[agi] stm: migrated version %d arena (seq=%lu)\n", ARENA_V4, stm->seq);
+    }
+    stm_close();
+    munmap(base, size);
+    if (!ok) {
+        fprintf(stderr, "[agi] stm: migration of %s failed\n", path);
+        unlink(tmp_path);
+        return false;
+    }
+    if (rename(tmp_path, path) != 0) {
+        perror("[agi] stm: rename after migration");
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+bool stm_migrate_legacy(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return true; // nothing to migrate
+    uint64_t head[2] = {0, 0}; // magic, version
+    struct stat st;
+    bool ours = pread(fd, head, sizeof(head), 0) == (ssize_t)sizeof(head) &&
+                head[0] == STM_MAGIC && fstat(fd, &st) == 0;
+    if (ours && head[1] == ARENA_V4)
+        return migrate_arena_v4(path, fd, (uint64_t)st.st_size);
+    if (!ours || head[1] < 1 || head[1] > sizeof(flat_layouts) / sizeof(flat_layouts[0])) {
+        close(fd);
+        return true; // an arena, or not ours at all; stm_open() deals with it
+    }
+    const layout_t* from = &flat_layouts[head[1] - 1];
+    unsigned char* old = malloc(from->size);
+    if (!old || (uint64_t)st.st_size < from->size ||
+        pread(fd, old, from->size, 0) != (ssize_t)from->size) {
+        fprintf(stderr, "[agi] stm: cannot read version %lu file for migration\n", head[1]);
+        free(old);
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    // the learner's state comes from the newest valid commit: the live fields may be torn
+    // mid-iteration. version 1 has no slots and only its live fields to go on
+    const layout_t* state = from;
+    const unsigned char* src = old;
+    uint64_t src_len = from->size;
+    const unsigned char* slot = flat_commit(head[1], old);
+    if (slot) {
+        state = &flat_commit_layouts[head[1] - 1];
+        src = slot;
+        src_len = state->size;
+    } else if (flat_commit_layouts[head[1] - 1].fields) {
+        fprintf(stderr, "[agi] stm: version %lu file has no valid commit, not migrating it\n",
+                head[1]);
+        free(old);
+        return true; // nothing worth keeping; stm_open() starts afresh
+    }
+
+    // the legacy weight count is explicit from version 3 on, implied by the field size before
+    const field_desc_t* w = find_field(state, "weights");
+    uint64_t cap = w->size / sizeof(double);
+    uint64_t n = cap;
+    const field_desc_t* nf = find_field(state, "n_features");
+    if (nf)
+        memcpy(&n, src + nf->offset, sizeof(n));
+    if (n < 1 || n > cap)
+        n = 1;
+
+    // build the arena next to the old file and swap it in, so a crash leaves one or the other
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.migrate", path);
+    unlink(tmp_path);
+    bool ok = stm_open(tmp_path) == STM_FRESH &&
+              stm_reserve("core", sizeof(stm_core_t), STM_DURABLE) &&
+              stm_reserve("weights", n * sizeof(double), STM_DURABLE) &&
+              stm_reserve("stats", sizeof(stm_stats_t), 0);
+    if (ok) {
+        stm_core_t* core = stm_section("core", NULL);
+        copy_fields(core, &core_layouts[CORE_LAYOUT], src, state, src_len);
+        core->n_features = n;
+        memcpy(stm_section("weights", NULL), src + w->offset, n * sizeof(double));
+        // the scratch line was never committed; take it as it is
+        copy_fields(stm_section("stats", NULL), &stats_layouts[STATS_LAYOUT], old, from,
+                    from->size);
+        stm_stamp_layouts();
+        stm_commit(MS_SYNC);
+        fprintf(stderr, "[agi] stm: migrated version %lu file to arena (iter=%lu features=%lu)\n",
+                head[1], core->iter, n);
+    }
+    stm_close();
+    free(old);
+    if (!ok) {
+        fprintf(stderr, "[agi] stm: migration of %s failed\n", path);
+        unlink(tmp_path);
+        return false;
+    }
+    if (rename(tmp_path, path) != 0) {
+        perror("[agi] stm: rename after migration");
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
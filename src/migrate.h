@@ -0,0 +1,23 @@
+/*
+  migrate.h - carrying learned state across STM layout changes
+  - flat stm_t files from before the arena (versions 1-3) are copied into a new arena file, which
+    is then renamed over the old one; so is a version 4 arena. both take the newest valid commit,
+    only version 1 (which had none) its live fields
+  - arena sections whose recorded layout is older than this binary's are upgraded in place
+  - both are driven by per-version field descriptors. fields are matched by name, so a field that
+    was added starts at zero and one that was removed is dropped
+*/
+#ifndef AGI_MIGRATE_H
+#define AGI_MIGRATE_H
+
+#include <stdbool.h>
+
+/* call before stm_open(); false only if a legacy file was found but could not be migrated */
+bool stm_migrate_legacy(const char* path);
+/* call after stm_open(), before the sections are bound; false if a section is newer than this
+   binary understands */
+bool stm_upgrade_sections(void);
+/* stamp the current layout on every known section, for a freshly created arena */
+void stm_stamp_layouts(void);
+
+#endif
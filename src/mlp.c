@@ -0,0 +1,155 @@
+#include "mlp.h"
+
+#include <math.h>
+#include <string.h>
+
+const char* const mlp_activation_names[MLP_ACTIVATION_COUNT] = {"relu", "tanh"};
+
+/* layer widths from the input to the output; returns the number of weight layers */
+static size_t layer_dims(const stm_mlp_t* mlp, size_t dims[MLP_MAX_HIDDEN + 2]) {
+    size_t n = (size_t)mlp->n_hidden;
+    dims[0] = (size_t)mlp->n_inputs;
+    for (size_t l = 0; l < n; l++)
+        dims[l + 1] = (size_t)mlp->width[l];
+    dims[n + 1] = 1;
+    return n + 1;
+}
+
+uint64_t mlp_param_count(const stm_mlp_t* mlp) {
+    size_t dims[MLP_MAX_HIDDEN + 2];
+    size_t layers = layer_dims(mlp, dims);
+    uint64_t n = 0;
+    for (size_t l = 1; l <= layers; l++)
+        n += dims[l] * (dims[l - 1] + 1);
+    return n;
+}
+
+size_t mlp_work_size(const stm_mlp_t* mlp) {
+    size_t dims[MLP_MAX_HIDDEN + 2];
+    size_t layers = layer_dims(mlp, dims);
+    size_t sum = 0, widest = 0;
+    for (size_t l = 0; l <= layers; l++) {
+        sum += dims[l];
+        if (dims[l] > widest)
+            widest = dims[l];
+    }
+    // every layer's activations, then two delta blocks for the backward pass
+    return MLP_CHUNK * (sum + 2 * widest);
+}
+
+void mlp_init_params(const stm_mlp_t* mlp, double* params) {
+    size_t dims[MLP_MAX_HIDDEN + 2];
+    size_t layers = layer_dims(mlp, dims);
+    for (size_t l = 1; l <= layers; l++) {
+        size_t in = dims[l - 1], out = dims[l];
+        double fan = mlp->activation == MLP_RELU ? (double)in : (double)(in + out) / 2.0;
+        double range = sqrt(3.0 / fan);
+        for (size_t i = 0; i < out * in; i++)
+            params[i] = (2.0 * params[i] - 1.0) * range;
+        params += out * in;
+        for (size_t i = 0; i < out; i++)
+            *params++ = 0.0;
+    }
+}
+
+static void activate(int activation, double* h, size_t n) {
+    if (activation == MLP_RELU) {
+        for (size_t i = 0; i < n; i++)
+            h[i] = h[i] > 0.0 ? h[i] : 0.0;
+    } else {
+        for (size_t i = 0; i < n; i++)
+            h[i] = tanh(h[i]);
+    }
+}
+
+/* d *= f'(z), from the activation's output h = f(z) */
+static void activate_backward(int activation, const double* h, double* d, size_t n) {
+    if (activation == MLP_RELU) {
+        for (size_t i = 0; i < n; i++)
+            d[i] = h[i] > 0.0 ? d[i] : 0.0;
+    } else {
+        for (size_t i = 0; i < n; i++)
+            d[i] *= 1.0 - h[i] * h[i];
+    }
+}
+
+/* run the rows through the network; h[l] points at layer l's m x dims[l] activations in 'work',
+   h[layers] is the output */
+static size_t forward_pass(const stm_mlp_t* mlp, const double* params, gemm_fn_t gemm,
+                           const double* const* rows, size_t m, double* work,
+                           double* h[MLP_MAX_HIDDEN + 2], size_t dims[MLP_MAX_HIDDEN + 2]) {
+    size_t layers = layer_dims(mlp, dims);
+    h[0] = work;
+    for (size_t l = 1; l <= layers; l++)
+        h[l] = h[l - 1] + MLP_CHUNK * dims[l - 1];
+    for (size_t i = 0; i < m; i++)
+        memcpy(h[0] + i * dims[0], rows[i], dims[0] * sizeof(double));
+    const double* p = params;
+    for (size_t l = 1; l <= layers; l++) {
+        size_t in = dims[l - 1], out = dims[l];
+        const double* w = p;
+        const double* b = p + out * in;
+        p = b + out;
+        // Z = H W^T + b
+        gemm(false, true, m, out, in, 1.0, h[l - 1], in, w, in, 0.0, h[l], out);
+        for (size_t i = 0; i < m; i++) {
+            double* z = h[l] + i * out;
+            for (size_t j = 0; j < out; j++)
+                z[j] += b[j];
+            if (l < layers)
+                activate((int)mlp->activation, z, out);
+        }
+    }
+    return layers;
+}
+
+void mlp_forward(const stm_mlp_t* mlp, const double* params, gemm_fn_t gemm,
+                 const double* const* rows, size_t m, double* out, double* work) {
+    double* h[MLP_MAX_HIDDEN + 2];
+    size_t dims[MLP_MAX_HIDDEN + 2];
+    size_t layers = forward_pass(mlp, params, gemm, rows, m, work, h, dims);
+    memcpy(out, h[layers], m * sizeof(double));
+}
+
+void mlp_gradient(const stm_mlp_t* mlp, const double* params, gemm_fn_t gemm,
+                  const double* const* rows, const double* reward, const double* weight, size_t m,
+                  double scale, double* grad, double* work) {
+    double* h[MLP_MAX_HIDDEN + 2];
+    size_t dims[MLP_MAX_HIDDEN + 2];
+    size_t layers = forward_pass(mlp, params, gemm, rows, m, work, h, dims);
+    double* delta = h[layers] + MLP_CHUNK * dims[layers];
+    size_t widest = 0;
+    for (size_t l = 0; l <= layers; l++)
+        widest = dims[l] > widest ? dims[l] : widest;
+    double* prev = delta + MLP_CHUNK * widest;
+
+    // dL/dy for the linear output
+    for (size_t i = 0; i < m; i++)
+        delta[i] = -scale * (weight ? weight[i] : 1.0) * (reward[i] - h[layers][i]);
+
+    // offsets of each layer's parameters, walked backwards
+    size_t offset[MLP_MAX_HIDDEN + 2];
+    offset[1] = 0;
+    for (size_t l = 1; l < layers; l++)
+        offset[l + 1] = offset[l] + dims[l] * (dims[l - 1] + 1);
+    for (size_t l = layers; l >= 1; l--) {
+        size_t in = dims[l - 1], out = dims[l];
+        const double* w = params + offset[l];
+        double* gw = grad + offset[l];
+        double* gb = gw + out * in;
+        // dW += dZ^T H, db += column sums of dZ
+        gemm(true, false, out, in, m, 1.0, delta, out, h[l - 1], in, 1.0, gw, in);
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = 0; j < out; j++)
+                gb[j] += delta[i * out + j];
+        }
+        if (l == 1)
+            break;
+        // dH = dZ W, then through the activation
+        gemm(false, false, m, in, out, 1.0, delta, out, w, in, 0.0, prev, in);
+        activate_backward((int)mlp->activation, h[l - 1], prev, m * in);
+        double* t = delta;
+        delta = prev;
+        prev = t;
+    }
+}
@@ -0,0 +1,46 @@
+/*
+  mlp.h - multi-layer perceptron over the parameters in the "weights" section
+  - shape in stm_mlp_t (state.h): n_inputs -> hidden widths -> 1 linear output
+  - rows are processed MLP_CHUNK at a time: gathered into a row-major block, then each layer is
+    one gemm (Z = H W^T) plus the bias and activation; the backward pass is two gemms per layer
+  - no state of its own: the caller hands in the gemm kernel and a work buffer of
+    mlp_work_size() doubles, so it links into the policy shared object as well
+*/
+#ifndef AGI_MLP_H
+#define AGI_MLP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gemm.h"
+#include "state.h"
+
+typedef enum {
+    MLP_RELU,
+    MLP_TANH,
+} mlp_activation_t;
+
+#define MLP_ACTIVATION_COUNT 2
+extern const char* const mlp_activation_names[MLP_ACTIVATION_COUNT];
+
+#define MLP_CHUNK 64
+#define MLP_WIDTH_MAX 1024
+
+/* parameters a shape needs (fills nothing in) */
+uint64_t mlp_param_count(const stm_mlp_t* mlp);
+/* doubles of work buffer a forward or gradient call needs */
+size_t mlp_work_size(const stm_mlp_t* mlp);
+/* fresh parameters: weights uniform in the He (relu) or Glorot (tanh) range, biases zero.
+   'params' comes in holding n_params uniform draws in [0, 1) (rng_bulk_fill: the policy library
+   links no rng of its own) and is scaled in place */
+void mlp_init_params(const stm_mlp_t* mlp, double* params);
+/* out[i] = the network's output for rows[i], m <= MLP_CHUNK */
+void mlp_forward(const stm_mlp_t* mlp, const double* params, gemm_fn_t gemm,
+                 const double* const* rows, size_t m, double* out, double* work);
+/* add the gradient of sum_i scale * weight[i] * (reward[i] - out_i)^2 / 2 to 'grad' (n_params
+   doubles); weight may be NULL. m <= MLP_CHUNK */
+void mlp_gradient(const stm_mlp_t* mlp, const double* params, gemm_fn_t gemm,
+                  const double* const* rows, const double* reward, const double* weight, size_t m,
+                  double scale, double* grad, double* work);
+
+#endif
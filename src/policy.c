@@ -0,0 +1,264 @@
+#include "policy.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "mlp.h"
+
+#define MOMENTUM 0.9
+#define ADAM_BETA1 0.9
+#define ADAM_BETA2 0.999
+#define ADAM_EPS 1e-8
+/* batches with fewer samples x parameters than this stay on the calling thread: below it the
+   pool's handoff costs more than the split saves */
+#define PARALLEL_MIN_WORK (1 << 15)
+/* tasks per thread when any thread may take any task, so stealing can even out the load */
+#define TASKS_PER_THREAD 4
+
+/* phi[0] is the old scalar input, then a one-hot of the phase, then a cosine basis over the
+   scalar input */
+static void make_features(int iter, double* phi, size_t n) {
+    int phase = iter % 10;
+    double x = (double)phase - 4.5; // in approx [-4.5, 5.5]
+    phi[0] = x;
+    for (size_t i = 1; i < n; i++) {
+        if (i <= 10)
+            phi[i] = (i - 1 == (size_t)phase) ? 1.0 : 0.0;
+        else
+            phi[i] = cos(0.25 * (double)(i - 10) * x);
+    }
+}
+
+static bool is_mlp(const policy_ctx_t* ctx) {
+    return ctx->mlp && ctx->mlp->n_hidden > 0;
+}
+
+/* parameters in use: the mlp's, or the feature weights */
+static size_t weight_count(const policy_ctx_t* ctx) {
+    return is_mlp(ctx) ? (size_t)ctx->mlp->n_params : ctx->core->n_features;
+}
+
+/* copy 'c' of the gradient scratch: an entry per weight, then the linear learner's bias */
+static double* grad_copy(const policy_ctx_t* ctx, size_t c) {
+    return ctx->grad + c * (weight_count(ctx) + 1);
+}
+
+static double* work_copy(const policy_ctx_t* ctx, size_t c) {
+    return is_mlp(ctx) ? ctx->work + c * mlp_work_size(ctx->mlp) : NULL;
+}
+
+/* whether 'rows' samples are worth handing to the pool */
+static bool worth_splitting(const policy_ctx_t* ctx, size_t rows) {
+    return ctx->parallel && ctx->threads > 1 && rows * (weight_count(ctx) + 1) >= PARALLEL_MIN_WORK;
+}
+
+/* score = dot(weights, phi) + bias for the linear learner, the network's output with an mlp */
+static double forward(const policy_ctx_t* ctx, const double* phi) {
+    if (is_mlp(ctx)) {
+        double out;
+        mlp_forward(ctx->mlp, ctx->weights, ctx->gemm, &phi, 1, &out, ctx->work);
+        return out;
+    }
+    return ctx->vec->dot(ctx->weights, phi, ctx->core->n_features) + ctx->core->bias;
+}
+
+typedef struct {
+    const policy_ctx_t* ctx;
+    const double* phi;
+    size_t n;
+    double* out;
+} forward_job_t;
+
+/* the outputs of chunk 'task' of a batch */
+static void forward_task(void* arg, size_t task, size_t worker) {
+    const forward_job_t* job = arg;
+    const policy_ctx_t* ctx = job->ctx;
+    size_t nf = ctx->core->n_features;
+    size_t i0 = task * MLP_CHUNK;
+    size_t m = job->n - i0 < MLP_CHUNK ? job->n - i0 : MLP_CHUNK;
+    if (!is_mlp(ctx)) {
+        for (size_t i = i0; i < i0 + m; i++)
+            job->out[i] = forward(ctx, job->phi + i * nf);
+        return;
+    }
+    const double* rows[MLP_CHUNK];
+    for (size_t i = 0; i < m; i++)
+        rows[i] = job->phi + (i0 + i) * nf;
+    mlp_forward(ctx->mlp, ctx->weights, ctx->gemm, rows, m, job->out + i0, work_copy(ctx, worker));
+}
+
+static void forward_batch(const policy_ctx_t* ctx, const double* phi, size_t n, double* out) {
+    forward_job_t job = {ctx, phi, n, out};
+    size_t chunks = (n + MLP_CHUNK - 1) / MLP_CHUNK;
+    if (worth_splitting(ctx, n)) {
+        ctx->parallel(chunks, forward_task, &job);
+        return;
+    }
+    for (size_t t = 0; t < chunks; t++)
+        forward_task(&job, t, 0);
+}
+
+/* the delta rule, normalised by the input energy so the learning rate means the same thing for
+   any feature count */
+static void nlms_step(const policy_ctx_t* ctx, const double* phi, double reward, double lr) {
+    size_t n = ctx->core->n_features;
+    double error = reward - forward(ctx, phi);
+    // gradient step: weights += step * phi, with the bias as a constant 1 input
+    double step = lr * error / (1.0 + ctx->vec->dot(phi, phi, n));
+    ctx->vec->axpy(step, phi, ctx->weights, n);
+    ctx->core->bias += step;
+}
+
+/* the mlp's online rule: one plain sgd step on the sample's squared error */
+static void mlp_sgd_step(const policy_ctx_t* ctx, const double* phi, double reward, double lr) {
+    size_t np = (size_t)ctx->mlp->n_params;
+    memset(ctx->grad, 0, np * sizeof(double));
+    mlp_gradient(ctx->mlp, ctx->weights, ctx->gemm, &phi, &reward, NULL, 1, 1.0, ctx->grad,
+                 ctx->work);
+    ctx->vec->axpy(-lr, ctx->grad, ctx->weights, np);
+}
+
+static void observe(const policy_ctx_t* ctx, double reward) {
+    ctx->core->running_reward = 0.99 * ctx->core->running_reward + 0.01 * reward;
+}
+
+/* add samples [begin, end)'s share of the minibatch's mean gradient (over all m) to g. the
+   linear one is the mean of the per-sample normalised gradients nlms_step follows, with the
+   bias's at g[n_features]; the mlp's is the plain squared error's */
+static void accumulate_gradient(const policy_ctx_t* ctx, const double* const* phi,
+                                const double* reward, const double* weight, size_t begin,
+                                size_t end, size_t m, double* g, double* work) {
+    if (is_mlp(ctx)) {
+        for (size_t i0 = begin; i0 < end; i0 += MLP_CHUNK) {
+            size_t c = end - i0 < MLP_CHUNK ? end - i0 : MLP_CHUNK;
+            mlp_gradient(ctx->mlp, ctx->weights, ctx->gemm, phi + i0, reward + i0,
+                         weight ? weight + i0 : NULL, c, 1.0 / (double)m, g, work);
+        }
+        return;
+    }
+    size_t n = ctx->core->n_features;
+    for (size_t i = begin; i < end; i++) {
+        double error = reward[i] - forward(ctx, phi[i]);
+        double c = -(weight ? weight[i] : 1.0) * error /
+                   ((1.0 + ctx->vec->dot(phi[i], phi[i], n)) * (double)m);
+        ctx->vec->axpy(c, phi[i], g, n);
+        g[n] += c;
+    }
+}
+
+typedef struct {
+    const policy_ctx_t* ctx;
+    const double* const* phi;
+    const double* reward;
+    const double* weight;
+    size_t m;
+    size_t tasks;
+} gradient_job_t;
+
+/* an even share of the minibatch. deterministic jobs have one task per copy, so every copy
+   always sums the same samples in the same order; otherwise each thread keeps its own copy and
+   steals whichever tasks are left */
+static void gradient_task(void* arg, size_t task, size_t worker) {
+    const gradient_job_t* job = arg;
+    size_t c = job->ctx->deterministic ? task : worker;
+    accumulate_gradient(job->ctx, job->phi, job->reward, job->weight, job->m * task / job->tasks,
+                        job->m * (task + 1) / job->tasks, job->m, grad_copy(job->ctx, c),
+                        work_copy(job->ctx, c));
+}
+
+/* the minibatch's mean gradient, left in the first copy of ctx->grad */
+static double* minibatch_gradient(const policy_ctx_t* ctx, const double* const* phi,
+                                  const double* reward, const double* weight, size_t m) {
+    size_t stride = weight_count(ctx) + 1;
+    gradient_job_t job = {ctx, phi, reward, weight, m, 1};
+    if (worth_splitting(ctx, m))
+        job.tasks = ctx->threads * (ctx->deterministic ? 1 : TASKS_PER_THREAD);
+    if (job.tasks > m)
+        job.tasks = m;
+    size_t copies = job.tasks == 1 ? 1 : ctx->deterministic ? job.tasks : ctx->threads;
+    memset(ctx->grad, 0, copies * stride * sizeof(double));
+    if (job.tasks == 1)
+        gradient_task(&job, 0, 0);
+    else
+        ctx->parallel(job.tasks, gradient_task, &job);
+    // the copies summed in index order, never concurrently
+    for (size_t c = 1; c < copies; c++)
+        ctx->vec->axpy(1.0, grad_copy(ctx, c), ctx->grad, stride);
+    return ctx->grad;
+}
+
+/* one optimizer step on n parameters 'w' down gradient 'g', with moments m1/m2. 't' is the
+   step count for Adam's bias correction */
+static void apply_gradient(const policy_ctx_t* ctx, int optimizer, double lr, uint64_t t,
+                           double* w, const double* g, double* m1, double* m2, size_t n) {
+    if (optimizer == OPTIM_SGD) {
+        ctx->vec->axpy(-lr, g, w, n);
+    } else if (optimizer == OPTIM_MOMENTUM) {
+        for (size_t j = 0; j < n; j++) {
+            m1[j] = MOMENTUM * m1[j] + g[j];
+            w[j] -= lr * m1[j];
+        }
+    } else {
+        // bias correction folded into the step size
+        double step = lr * sqrt(1.0 - pow(ADAM_BETA2, (double)t)) /
+                      (1.0 - pow(ADAM_BETA1, (double)t));
+        for (size_t j = 0; j < n; j++) {
+            m1[j] = ADAM_BETA1 * m1[j] + (1.0 - ADAM_BETA1) * g[j];
+            m2[j] = ADAM_BETA2 * m2[j] + (1.0 - ADAM_BETA2) * g[j] * g[j];
+            w[j] -= step * m1[j] / (sqrt(m2[j]) + ADAM_EPS);
+        }
+    }
+}
+
+/* simple online update. durability is left to the host */
+static void update_weights(const policy_ctx_t* ctx, const double* phi, double reward, double lr) {
+    if (is_mlp(ctx))
+        mlp_sgd_step(ctx, phi, reward, lr);
+    else
+        nlms_step(ctx, phi, reward, lr);
+    observe(ctx, reward);
+}
+
+/* minibatch step: every sample is scored against the same weights, then one update. the linear
+   gradient's scaling keeps LEARNING_RATE's meaning for sgd and momentum (for adam it is the
+   step size); nlms runs the online rule over the samples in order */
+static void train(const policy_ctx_t* ctx, const double* const* phi, const double* reward,
+                  const double* weight, size_t m, int optimizer, double lr) {
+    if (m == 0)
+        return;
+    if (optimizer == OPTIM_NLMS) {
+        for (size_t i = 0; i < m; i++) {
+            double step_lr = weight ? lr * weight[i] : lr;
+            if (is_mlp(ctx))
+                mlp_sgd_step(ctx, phi[i], reward[i], step_lr);
+            else
+                nlms_step(ctx, phi[i], reward[i], step_lr);
+        }
+        return;
+    }
+    stm_optim_t* opt = ctx->optim;
+    size_t n = weight_count(ctx);
+    double* g = minibatch_gradient(ctx, phi, reward, weight, m);
+    opt->steps++;
+    apply_gradient(ctx, optimizer, lr, opt->steps, ctx->weights, g, ctx->optim_m, ctx->optim_v,
+                   n);
+    if (!is_mlp(ctx))
+        apply_gradient(ctx, optimizer, lr, opt->steps, &ctx->core->bias, &g[n], &opt->bias_m,
+                       &opt->bias_v, 1);
+}
+
+static const policy_api_t api = {
+        .abi = POLICY_ABI,
+        .name = "linear-mlp",
+        .features = make_features,
+        .forward = forward,
+        .forward_batch = forward_batch,
+        .update = update_weights,
+        .observe = observe,
+        .train = train,
+};
+
+const policy_api_t* agi_policy(void) {
+    return &api;
+}
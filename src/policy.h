@@ -0,0 +1,77 @@
+/*
+  policy.h - the learner/policy code behind a stable function table
+  - policy.c is linked into the binary as a fallback and also built as build/libagi_policy.so,
+    which the host rebuilds and swaps in with dlopen on every self-modification
+  - the policy owns no state: everything it touches comes in through policy_ctx_t, so the STM
+    mapping and every descriptor survive a reload
+  - the model is linear over the features, or an mlp (mlp.h) when ctx->mlp has hidden layers;
+    its parameters then fill ctx->weights and the gemm kernel comes in through the context too
+  - update is the online rule, one step per sample; train takes a minibatch, accumulates one
+    gradient over it and applies it with the selected optimizer, whose state is in STM as well
+  - with a thread pool in the context, big minibatch gradients and batched forwards are split
+    across it: every thread (or, with ctx->deterministic, every task) accumulates its own copy of
+    the gradient and the copies are summed in a fixed order, nothing shared is written atomically
+  - bump POLICY_ABI whenever policy_ctx_t or policy_api_t change
+*/
+#ifndef AGI_POLICY_H
+#define AGI_POLICY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gemm.h"
+#include "pool.h"
+#include "state.h"
+#include "vec.h"
+
+#define POLICY_ABI 4
+#define POLICY_SYMBOL "agi_policy"
+
+/* how train applies its gradient */
+typedef enum {
+    OPTIM_NLMS,     // the online rule per sample, in order (no gradient accumulation)
+    OPTIM_SGD,      // one step down the minibatch's mean gradient
+    OPTIM_MOMENTUM, // heavy ball
+    OPTIM_ADAM,
+} optimizer_t;
+
+#define OPTIMIZER_COUNT 4
+
+typedef struct {
+    stm_core_t* core;
+    double* weights; // core->n_features entries, or mlp->n_params with an mlp
+    const vec_ops_t* vec;
+    stm_optim_t* optim;
+    double* optim_m; // as many entries as the weights
+    double* optim_v;
+    double* grad; // scratch owned by the host: 'threads' copies, each one longer than the weights
+    const stm_mlp_t* mlp; // NULL or no hidden layers: the linear learner
+    gemm_fn_t gemm;
+    double* work; // scratch owned by the host: 'threads' copies of mlp_work_size() doubles
+    pool_run_fn_t parallel; // the host's thread pool, NULL = everything on the calling thread
+    size_t threads;         // the pool's threads, 1 without one
+    bool deterministic;     // split and sum gradients the same way whatever the scheduling
+} policy_ctx_t;
+
+typedef struct {
+    uint32_t abi;
+    const char* name; // the library's, whatever model ctx selects (main reports that)
+    /* perception: expand the step counter into n features */
+    void (*features)(int iter, double* phi, size_t n);
+    double (*forward)(const policy_ctx_t* ctx, const double* phi);
+    /* out[i] = forward of the i-th of n feature vectors stored back to back in phi */
+    void (*forward_batch)(const policy_ctx_t* ctx, const double* phi, size_t n, double* out);
+    void (*update)(const policy_ctx_t* ctx, const double* phi, double reward, double lr);
+    /* fold a fresh reward into running_reward, for steps that train does not learn from at once */
+    void (*observe)(const policy_ctx_t* ctx, double reward);
+    /* one minibatch step over the 'n' samples (phi[i], reward[i]), each weighted by weight[i]
+       (NULL = all 1). running_reward is left alone */
+    void (*train)(const policy_ctx_t* ctx, const double* const* phi, const double* reward,
+                  const double* weight, size_t n, int optimizer, double lr);
+} policy_api_t;
+
+/* the one exported symbol of the shared object */
+const policy_api_t* agi_policy(void);
+
+#endif
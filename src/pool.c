@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include "pool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+#define DEQUE_CAP 64         // entries, a power of two; halving keeps at most log2(n) of them
+#define SPIN_POLLS 20000     // polls of an idle worker for the next job before it sleeps
+#define YIELD_EVERY 64       // failed steal rounds between sched_yields, for oversubscribed hosts
+#define RANGE_MAX UINT32_MAX // task ranges are packed into one word, see pack
+
+/* Chase-Lev deque of task ranges. the owner pushes and pops at the bottom, thieves take from the
+   top. indices only ever grow, so an entry's slot is index % DEQUE_CAP */
+typedef struct {
+    _Alignas(64) int64_t top;
+    _Alignas(64) int64_t bottom;
+    uint64_t slot[DEQUE_CAP];
+} deque_t;
+
+static struct {
+    size_t threads; // the caller included
+    pthread_t tid[POOL_THREADS_MAX];
+    deque_t deque[POOL_THREADS_MAX];
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    // the current job: written under 'lock', and read under it when a worker joins
+    uint64_t generation;
+    bool stopping;
+    pool_task_fn_t fn;
+    void* arg;
+    size_t n_tasks;
+    _Alignas(64) size_t done;   // tasks of the current job finished
+    _Alignas(64) size_t active; // workers inside a job
+} pool = {
+        .threads = 1,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .wake = PTHREAD_COND_INITIALIZER,
+};
+
+/* this thread's worker index (0 for every thread outside the pool), and whether it is inside
+   a job right now */
+static _Thread_local size_t self = 0;
+static _Thread_local bool running = false;
+
+static inline uint64_t pack(size_t begin, size_t end) {
+    return (uint64_t)begin << 32 | (uint64_t)end;
+}
+
+static void push(deque_t* d, uint64_t x) {
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->slot[b & (DEQUE_CAP - 1)], x, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+static bool pop(deque_t* d, uint64_t* x) {
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    *x = __atomic_load_n(&d->slot[b & (DEQUE_CAP - 1)], __ATOMIC_RELAXED);
+    if (t < b)
+        return true;
+    // the last entry: whoever moves top first has it
+    bool won = __atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST,
+                                           __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+static bool steal(deque_t* d, uint64_t* x) {
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return false;
+    *x = __atomic_load_n(&d->slot[t & (DEQUE_CAP - 1)], __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_RELAXED);
+}
+
+/* worker w's share of a job: its own deque first, then the others', until every task is done */
+static void work(size_t w, pool_task_fn_t fn, void* arg, size_t n) {
+    deque_t* own = &pool.deque[w];
+    size_t threads = pool.threads;
+    unsigned idle = 0;
+    running = true;
+    for (;;) {
+        uint64_t r;
+        bool got = pop(own, &r);
+        for (size_t i = 1; !got && i < threads; i++)
+            got = steal(&pool.deque[(w + i) % threads], &r);
+        if (!got) {
+            if (__atomic_load_n(&pool.done, __ATOMIC_ACQUIRE) == n) {
+                running = false;
+                return;
+            }
+            if (++idle % YIELD_EVERY == 0)
+                sched_yield();
+            else
+                cpu_relax();
+            continue;
+        }
+        idle = 0;
+        size_t begin = (size_t)(r >> 32), end = (size_t)(r & 0xffffffffu);
+        // keep the first task, leave the rest in halves for whoever comes for them
+        while (end - begin > 1) {
+            size_t mid = begin + (end - begin) / 2;
+            push(own, pack(mid, end));
+            end = mid;
+        }
+        fn(arg, begin, w);
+        __atomic_fetch_add(&pool.done, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+static void* worker_main(void* p) {
+    size_t w = (size_t)(uintptr_t)p;
+    self = w;
+    pthread_mutex_lock(&pool.lock);
+    uint64_t seen = pool.generation;
+    pthread_mutex_unlock(&pool.lock);
+    for (;;) {
+        for (int i = 0; i < SPIN_POLLS; i++) {
+            if (__atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE) != seen ||
+                __atomic_load_n(&pool.stopping, __ATOMIC_ACQUIRE))
+                break;
+            cpu_relax();
+        }
+        pthread_mutex_lock(&pool.lock);
+        while (pool.generation == seen && !pool.stopping)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        if (pool.stopping) {
+            pthread_mutex_unlock(&pool.lock);
+            return NULL;
+        }
+        seen = pool.generation;
+        pool_task_fn_t fn = pool.fn;
+        void* arg = pool.arg;
+        size_t n = pool.n_tasks;
+        __atomic_fetch_add(&pool.active, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pool.lock);
+        work(w, fn, arg, n);
+        __atomic_fetch_sub(&pool.active, 1, __ATOMIC_RELEASE);
+    }
+}
+
+bool pool_start(size_t threads) {
+    if (threads < 1)
+        threads = 1;
+    if (threads > POOL_THREADS_MAX)
+        threads = POOL_THREADS_MAX;
+    if (threads == pool.threads)
+        return true;
+    pool_stop();
+    for (size_t w = 1; w < threads; w++) {
+        int err = pthread_create(&pool.tid[w], NULL, worker_main, (void*)(uintptr_t)w);
+        if (err) {
+            fprintf(stderr, "[agi] pthread_create(pool): %s\n", strerror(err));
+            pool.threads = w;
+            pool_stop();
+            return false;
+        }
+    }
+    pool.threads = threads;
+    return true;
+}
+
+void pool_stop(void) {
+    if (pool.threads <= 1)
+        return;
+    pthread_mutex_lock(&pool.lock);
+    __atomic_store_n(&pool.stopping, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for (size_t w = 1; w < pool.threads; w++)
+        pthread_join(pool.tid[w], NULL);
+    pool.stopping = false;
+    pool.threads = 1;
+}
+
+size_t pool_threads(void) {
+    return pool.threads;
+}
+
+void pool_run(size_t n_tasks, pool_task_fn_t fn, void* arg) {
+    if (pool.threads <= 1 || n_tasks <= 1 || n_tasks > RANGE_MAX || running) {
+        for (size_t t = 0; t < n_tasks; t++)
+            fn(arg, t, self);
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    // stragglers of the last job are still watching its counter; let them leave first
+    while (__atomic_load_n(&pool.active, __ATOMIC_ACQUIRE) > 0)
+        sched_yield();
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.n_tasks = n_tasks;
+    __atomic_store_n(&pool.done, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool.generation, pool.generation + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    push(&pool.deque[0], pack(0, n_tasks));
+    work(0, fn, arg, n_tasks);
+}
+
+void pool_forked(void) {
+    pool.threads = 1;
+    pool.active = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+}
@@ -0,0 +1,35 @@
+/*
+  pool.h - work-stealing thread pool for the learner's data-parallel loops
+  - THREADS=N keeps N-1 worker threads; the thread calling pool_run is worker 0 and works too
+  - pool_run(n, fn, arg) runs fn(arg, task, worker) for every task in [0, n) and returns when
+    all are done. ranges of tasks sit in per-worker Chase-Lev deques: a worker halves the range
+    it holds, keeps the front and leaves the back for thieves, who steal the largest pieces
+  - 'worker' is below pool_threads(), so a task can pick per-thread scratch by it; which worker
+    runs which task is up to scheduling. for a reduction that must not depend on scheduling,
+    give every task its own partial and combine them in task order (see policy.c)
+  - idle workers spin briefly, then sleep on a condition variable until the next pool_run
+  - tasks must not call pool_run (a nested call runs its tasks on the calling thread), and only
+    one thread may call it at a time. forked children call pool_forked() first
+*/
+#ifndef AGI_POOL_H
+#define AGI_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define POOL_THREADS_MAX 64
+
+typedef void (*pool_task_fn_t)(void* arg, size_t task, size_t worker);
+/* pool_run's type, for code that gets it through a function table (policy_ctx_t) */
+typedef void (*pool_run_fn_t)(size_t n_tasks, pool_task_fn_t fn, void* arg);
+
+/* (re)start with 'threads' workers, the caller included; 1 stops every thread. false (and the
+   pool runs everything on the caller) if a thread cannot be created */
+bool pool_start(size_t threads);
+void pool_stop(void);
+size_t pool_threads(void);
+void pool_run(size_t n_tasks, pool_task_fn_t fn, void* arg);
+/* in a fork child: the threads stayed behind with the parent, run everything on this one */
+void pool_forked(void);
+
+#endif
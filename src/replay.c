@@ -0,0 +1,184 @@
+#include "replay.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "state.h"
+#include "stm.h"
+
+const char* const replay_sampling_names[REPLAY_SAMPLING_COUNT] = {"uniform", "prioritized"};
+
+/* the section and its arrays, looked up again whenever the mapping moved */
+static struct {
+    uint64_t remaps;
+    stm_replay_t* hdr;
+    double* reward;
+    uint64_t* iter;
+    double* tree;
+    double* phi;
+} rb = {UINT64_MAX, NULL, NULL, NULL, NULL, NULL};
+
+static uint64_t section_size(uint64_t cap, uint64_t nf) {
+    return sizeof(stm_replay_t) + cap * (2 + 2 + nf) * sizeof(double);
+}
+
+static bool lookup(void) {
+    if (rb.remaps == stm_remaps)
+        return rb.hdr != NULL;
+    rb.remaps = stm_remaps;
+    rb.hdr = stm_section("replay", NULL);
+    if (!rb.hdr)
+        return false;
+    uint64_t cap = rb.hdr->capacity;
+    rb.reward = (double*)(rb.hdr + 1);
+    rb.iter = (uint64_t*)(rb.reward + cap);
+    rb.tree = (double*)(rb.iter + cap);
+    rb.phi = rb.tree + 2 * cap;
+    return true;
+}
+
+void replay_clear(void) {
+    if (!lookup())
+        return;
+    uint64_t cap = rb.hdr->capacity;
+    memset(rb.tree, 0, 2 * cap * sizeof(double));
+    rb.hdr->head = 0;
+    rb.hdr->count = 0;
+    rb.hdr->max_priority = 1.0;
+}
+
+bool replay_bind(uint64_t capacity, uint64_t n_features) {
+    uint64_t cap = 8;
+    while (cap < capacity && cap < REPLAY_CAPACITY_MAX)
+        cap *= 2;
+    uint64_t size = 0;
+    stm_replay_t* h = stm_section("replay", &size);
+    bool fits = h && stm_layout("replay") == REPLAY_LAYOUT && h->capacity == cap &&
+                h->n_features == n_features && size >= section_size(cap, n_features);
+    if (!fits) {
+        if (!stm_reserve("replay", section_size(cap, n_features), 0))
+            return false;
+        stm_set_layout("replay", REPLAY_LAYOUT);
+        h = stm_section("replay", NULL);
+        h->capacity = cap;
+        h->n_features = n_features;
+        rb.remaps = UINT64_MAX; // the arrays moved with the new shape
+        replay_clear();
+    }
+    return lookup();
+}
+
+uint64_t replay_count(void) {
+    return lookup() ? rb.hdr->count : 0;
+}
+
+/* --- sum tree: node k holds the sum of its children 2k and 2k + 1, slot i is leaf cap + i --- */
+static void tree_set(uint64_t slot, double priority) {
+    uint64_t k = rb.hdr->capacity + slot;
+    double delta = priority - rb.tree[k];
+    for (; k >= 1; k /= 2)
+        rb.tree[k] += delta;
+}
+
+/* the slot whose cumulative priority range contains 'u', for u in [0, total) */
+static uint64_t tree_find(double u) {
+    uint64_t cap = rb.hdr->capacity;
+    uint64_t k = 1;
+    while (k < cap) {
+        if (u < rb.tree[2 * k]) {
+            k = 2 * k;
+        } else {
+            u -= rb.tree[2 * k];
+            k = 2 * k + 1;
+        }
+    }
+    uint64_t slot = k - cap;
+    // rounding in the sums can walk past the filled slots
+    return slot < rb.hdr->count ? slot : rb.hdr->count - 1;
+}
+
+void replay_push(const double* phi, double reward, uint64_t iter) {
+    if (!lookup())
+        return;
+    stm_replay_t* h = rb.hdr;
+    uint64_t slot = h->head;
+    rb.reward[slot] = reward;
+    rb.iter[slot] = iter;
+    memcpy(rb.phi + slot * h->n_features, phi, h->n_features * sizeof(double));
+    tree_set(slot, h->max_priority);
+    h->head = (slot + 1) & (h->capacity - 1);
+    if (h->count < h->capacity)
+        h->count++;
+}
+
+size_t replay_sample(rng_bulk_t* b, int sampling, size_t batch, uint32_t* slot,
+                     double* weight) {
+    if (!lookup() || rb.hdr->count == 0)
+        return 0;
+    uint64_t n = rb.hdr->count;
+    if (batch > REPLAY_BATCH_MAX)
+        batch = REPLAY_BATCH_MAX;
+    // the whole minibatch's draws at once; 52 bits against n <= 2^20 leave no bias worth noting
+    double u[REPLAY_BATCH_MAX];
+    rng_bulk_fill(b, u, batch);
+    if (sampling != REPLAY_PRIORITIZED) {
+        for (size_t i = 0; i < batch; i++) {
+            slot[i] = (uint32_t)(u[i] * (double)n);
+            weight[i] = 1.0;
+        }
+        return batch;
+    }
+    // stratified: one draw from each of 'batch' equal slices of the total priority
+    double total = rb.tree[1];
+    double slice = total / (double)batch;
+    double max_w = 0;
+    for (size_t i = 0; i < batch; i++) {
+        uint64_t s = tree_find(((double)i + u[i]) * slice);
+        slot[i] = (uint32_t)s;
+        double p = rb.tree[rb.hdr->capacity + s] / total;
+        weight[i] = pow((double)n * p, -REPLAY_BETA);
+        if (weight[i] > max_w)
+            max_w = weight[i];
+    }
+    for (size_t i = 0; i < batch; i++)
+        weight[i] /= max_w;
+    return batch;
+}
+
+const double* replay_phi(uint32_t slot) {
+    return rb.phi + slot * rb.hdr->n_features;
+}
+
+double replay_reward(uint32_t slot) {
+    return rb.reward[slot];
+}
+
+void replay_set_error(uint32_t slot, double error) {
+    double p = pow(fabs(error) + REPLAY_EPS, REPLAY_ALPHA);
+    tree_set(slot, p);
+    if (p > rb.hdr->max_priority)
+        rb.hdr->max_priority = p;
+}
+
+size_t replay_train(const policy_api_t* policy, const policy_ctx_t* ctx, rng_bulk_t* b,
+                    int sampling, size_t batch, int optimizer, int epochs, double lr) {
+    uint32_t slot[REPLAY_BATCH_MAX];
+    double weight[REPLAY_BATCH_MAX];
+    const double* phi[REPLAY_BATCH_MAX];
+    double reward[REPLAY_BATCH_MAX];
+    if (batch > REPLAY_BATCH_MAX)
+        batch = REPLAY_BATCH_MAX;
+    // a sample stored at another feature count no longer lines up with the weights
+    if (!lookup() || rb.hdr->n_features != ctx->core->n_features)
+        return 0;
+    size_t n = replay_sample(b, sampling, batch, slot, weight);
+    for (size_t i = 0; i < n; i++) {
+        phi[i] = replay_phi(slot[i]);
+        reward[i] = replay_reward(slot[i]);
+        if (sampling == REPLAY_PRIORITIZED)
+            replay_set_error(slot[i], reward[i] - policy->forward(ctx, phi[i]));
+    }
+    for (int e = 0; e < epochs; e++)
+        policy->train(ctx, phi, reward, weight, n, optimizer, lr);
+    return n;
+}
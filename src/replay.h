@@ -0,0 +1,59 @@
+/*
+  replay.h - experience replay from the "replay" STM section
+  - a fixed-capacity ring of (features, reward, iter) samples stored as structure-of-arrays in the
+    mapping (layout in state.h), so it survives exec and reloads like the rest of STM. it is not
+    covered by commits: a crash can leave a torn sample, never a torn weight
+  - sampling is uniform, or prioritized: proportional to (|error| + eps)^alpha through a sum tree
+    over the slots, with importance weights (annealed by beta) scaling each update
+  - replay_train draws a minibatch, refreshes the drawn samples' priorities from their current
+    errors and hands it to the policy's minibatch trainer
+*/
+#ifndef AGI_REPLAY_H
+#define AGI_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "policy.h"
+#include "rng.h"
+
+typedef enum {
+    REPLAY_UNIFORM,
+    REPLAY_PRIORITIZED,
+} replay_sampling_t;
+
+#define REPLAY_SAMPLING_COUNT 2
+extern const char* const replay_sampling_names[REPLAY_SAMPLING_COUNT];
+
+#define REPLAY_CAPACITY_MAX (1u << 20)
+#define REPLAY_BATCH_MAX 1024
+#define REPLAY_ALPHA 0.6 // how strongly priorities skew sampling, 0 = uniform
+#define REPLAY_BETA 0.4  // how much of that skew the importance weights undo, 1 = all of it
+#define REPLAY_EPS 1e-3  // keeps a sample with zero error drawable
+
+/* create or adopt the section for 'capacity' samples (rounded up to a power of two, at least 8)
+   of 'n_features' each. a section of another shape or layout is cleared. may move the mapping */
+bool replay_bind(uint64_t capacity, uint64_t n_features);
+/* drop every sample (the shape stays) */
+void replay_clear(void);
+/* samples held */
+uint64_t replay_count(void);
+/* store one sample, overwriting the oldest once full */
+void replay_push(const double* phi, double reward, uint64_t iter);
+/* draw 'batch' slots into 'slot' with their importance weights (all 1 for uniform sampling,
+   otherwise normalised so the largest is 1), all from one bulk fill of 'b'. returns the number
+   drawn (at most REPLAY_BATCH_MAX), 0 while empty */
+size_t replay_sample(rng_bulk_t* b, int sampling, size_t batch, uint32_t* slot,
+                     double* weight);
+/* a stored sample's feature vector and reward */
+const double* replay_phi(uint32_t slot);
+double replay_reward(uint32_t slot);
+/* set a slot's priority from its latest prediction error */
+void replay_set_error(uint32_t slot, double error);
+/* draw a minibatch of up to 'batch' samples and train on it 'epochs' times with 'optimizer' at
+   learning rate 'lr', each sample weighted by its importance weight. returns the samples drawn */
+size_t replay_train(const policy_api_t* policy, const policy_ctx_t* ctx, rng_bulk_t* b,
+                    int sampling, size_t batch, int optimizer, int epochs, double lr);
+
+#endif
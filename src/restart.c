@@ -0,0 +1,113 @@
+#include "restart.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+_Static_assert(RESTART_PHASE_COUNT == RESTART_PHASES, "one stamp per restart_phase_t");
+
+const char* const restart_phase_names[RESTART_PHASE_COUNT] = {
+        "mutate", "built", "exec", "main", "config", "mapped", "first"};
+
+static stm_restart_t* rs = NULL;
+static uint64_t early[RESTART_PHASES]; // stamps taken before the section was bound
+static bool open_cycle = false;        // this process has a cycle (or its startup) to close
+static bool cold = false;              // and it is a startup, not a restart
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void restart_bind(stm_restart_t* r) {
+    bool first = rs == NULL;
+    rs = r;
+    if (!first)
+        return;
+    // an exec'd generation finds its cycle pending; anything else is started by hand
+    cold = !r->pending;
+    if (cold)
+        memset(r->stamp, 0, sizeof(r->stamp));
+    for (int i = 0; i < RESTART_PHASES; i++) {
+        if (early[i])
+            r->stamp[i] = early[i];
+    }
+    r->pending = 1;
+    open_cycle = true;
+}
+
+void restart_begin(void) {
+    if (!rs)
+        return;
+    memset(rs->stamp, 0, sizeof(rs->stamp));
+    rs->stamp[RESTART_MUTATE] = now_ns();
+    rs->pending = 1;
+    open_cycle = true;
+    cold = false;
+}
+
+void restart_mark(int phase) {
+    if (rs)
+        rs->stamp[phase] = now_ns();
+    else
+        early[phase] = now_ns();
+}
+
+void restart_cancel(void) {
+    if (rs)
+        rs->pending = 0;
+    open_cycle = false;
+}
+
+bool restart_finish(char* out, size_t len) {
+    if (!open_cycle)
+        return false;
+    open_cycle = false;
+    rs->stamp[RESTART_FIRST] = now_ns();
+    rs->pending = 0;
+    // each phase against the one reached before it; a reboot in between leaves stamps that
+    // run backwards, and such a cycle is not counted
+    uint64_t gap[RESTART_PHASES] = {0};
+    int from = -1;
+    for (int i = 0, prev = -1; i < RESTART_PHASES; i++) {
+        if (!rs->stamp[i])
+            continue;
+        if (prev < 0)
+            from = i;
+        else if (rs->stamp[i] < rs->stamp[prev])
+            return false;
+        else
+            gap[i] = rs->stamp[i] - rs->stamp[prev];
+        prev = i;
+    }
+    uint64_t total = rs->stamp[RESTART_FIRST] - rs->stamp[from];
+    int n = cold ? snprintf(out, len, "startup:")
+                 : snprintf(out, len, "restart %lu:", rs->cycles + 1);
+    const char* unit = " ms";
+    for (int i = from + 1; i < RESTART_PHASES && n >= 0 && (size_t)n < len; i++) {
+        if (!rs->stamp[i])
+            continue;
+        n += snprintf(out + n, len - (size_t)n, " %s %.1f%s,", restart_phase_names[i],
+                      (double)gap[i] / 1e6, unit);
+        unit = "";
+    }
+    if (n < 0 || (size_t)n >= len)
+        return true;
+    n--; // the last comma
+    if (cold) {
+        snprintf(out + n, len - (size_t)n, "; %.1f ms from main to the first iteration",
+                 (double)total / 1e6);
+        return true;
+    }
+    rs->cycles++;
+    uint64_t sum = 0;
+    for (int i = 0; i < RESTART_PHASES; i++) {
+        rs->sum[i] += gap[i];
+        sum += rs->sum[i];
+    }
+    snprintf(out + n, len - (size_t)n, "; %.1f ms down (mean %.1f over %lu)", (double)total / 1e6,
+             (double)sum / 1e6 / (double)rs->cycles, rs->cycles);
+    return true;
+}
@@ -0,0 +1,48 @@
+/*
+  restart.h - where the downtime of a self-modification cycle goes
+  - a cycle is stamped at every phase it reaches: the loop deciding to mutate, the build being
+    ready (make, or the build cache), execv (after the final commit), the new generation's main,
+    its config loaded, its arena mapped with every section bound (and a crash's log replayed),
+    and its first iteration done
+  - stamps are CLOCK_MONOTONIC, which is system-wide, so those from before an exec compare with
+    those after it. they are kept in the "restart" section of STM (state.h), which the exec
+    leaves in place
+  - a dlopen reload only passes mutate, built and first; a config-only mutation skips built
+  - main and config come before the arena is mapped and are held until restart_bind
+  - the cycle is closed and logged at the first iteration after it, with the running mean. a
+    process started by hand logs its startup (main to the first iteration) instead
+*/
+#ifndef AGI_RESTART_H
+#define AGI_RESTART_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "state.h"
+
+typedef enum {
+    RESTART_MUTATE,
+    RESTART_BUILT,
+    RESTART_EXEC,
+    RESTART_MAIN,
+    RESTART_CONFIG,
+    RESTART_MAPPED,
+    RESTART_FIRST,
+} restart_phase_t;
+
+#define RESTART_PHASE_COUNT 7
+extern const char* const restart_phase_names[RESTART_PHASE_COUNT];
+
+/* the section, whenever the mapping may have moved; the first call adopts the stamps taken
+   before it */
+void restart_bind(stm_restart_t* r);
+/* a cycle starts: the loop has decided to mutate (or to roll a mutation back) */
+void restart_begin(void);
+void restart_mark(int phase);
+/* the cycle ended without a rebuild */
+void restart_cancel(void);
+/* at the end of every iteration: stamp and close the open cycle, false if there is none.
+   'out' receives the line to log */
+bool restart_finish(char* out, size_t len);
+
+#endif
@@ -0,0 +1,221 @@
+#include "rng.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RNG_X86 1
+#include <immintrin.h>
+#endif
+
+static const uint64_t jump_poly[4] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                      0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+static const uint64_t long_jump_poly[4] = {0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+                                           0x77710069854ee241ULL, 0x39109bb02acbe635ULL};
+
+static uint64_t splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void rng_seed(rng_t* r, uint64_t seed) {
+    for (int i = 0; i < 4; i++)
+        r->s[i] = splitmix64(&seed);
+}
+
+static void jump_by(rng_t* r, const uint64_t poly[4]) {
+    uint64_t acc[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 64; b++) {
+            if (poly[i] & (1ULL << b)) {
+                for (int k = 0; k < 4; k++)
+                    acc[k] ^= r->s[k];
+            }
+            rng_next(r);
+        }
+    }
+    memcpy(r->s, acc, sizeof(acc));
+}
+
+void rng_jump(rng_t* r) {
+    jump_by(r, jump_poly);
+}
+
+void rng_long_jump(rng_t* r) {
+    jump_by(r, long_jump_poly);
+}
+
+/* --- per-thread streams --- */
+
+/* stream k of the current family is the family base jumped k times. a thread notices a new
+   seed or family through 'epoch' and claims a fresh stream */
+static rng_t root; // family 0, as seeded by rng_init
+static rng_t family_base;
+static uint64_t seed_used = 0;
+static uint64_t epoch = 0;
+static uint64_t next_stream = 0;
+
+typedef struct {
+    rng_t r;
+    uint64_t epoch;
+} local_rng_t;
+
+typedef struct {
+    rng_bulk_t b;
+    uint64_t epoch;
+} local_bulk_t;
+
+static _Thread_local local_rng_t local;
+static _Thread_local local_bulk_t local_bulk;
+
+static void start_epoch(const rng_t* base) {
+    family_base = *base;
+    __atomic_store_n(&next_stream, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&epoch, 1, __ATOMIC_RELEASE);
+}
+
+rng_t* rng_local(void) {
+    uint64_t e = __atomic_load_n(&epoch, __ATOMIC_ACQUIRE);
+    if (local.epoch != e) {
+        uint64_t k = __atomic_fetch_add(&next_stream, 1, __ATOMIC_RELAXED);
+        local.r = family_base;
+        for (uint64_t i = 0; i < k; i++)
+            rng_jump(&local.r);
+        local.epoch = e;
+    }
+    return &local.r;
+}
+
+rng_bulk_t* rng_local_bulk(void) {
+    uint64_t e = __atomic_load_n(&epoch, __ATOMIC_ACQUIRE);
+    if (local_bulk.epoch != e) {
+        // four streams of the current family, claimed as rng_local claims one
+        uint64_t k = __atomic_fetch_add(&next_stream, 4, __ATOMIC_RELAXED);
+        rng_t r = family_base;
+        for (uint64_t i = 0; i < k; i++)
+            rng_jump(&r);
+        rng_bulk_init(&local_bulk.b, &r);
+        local_bulk.epoch = e;
+    }
+    return &local_bulk.b;
+}
+
+void rng_branch(uint64_t family) {
+    rng_t base = root;
+    for (uint64_t i = 0; i < family; i++)
+        rng_long_jump(&base);
+    start_epoch(&base);
+}
+
+uint64_t rng_seed_used(void) {
+    return seed_used;
+}
+
+/* --- bulk kernels --- */
+
+/* 52 random bits as the mantissa of a double in [1, 2), minus one: what avx2 can do without a
+   64-bit integer conversion, so the scalar kernel does the same */
+static double bits_to_unit(uint64_t x) {
+    uint64_t u = (x >> 12) | 0x3ff0000000000000ULL;
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d - 1.0;
+}
+
+static void fill_scalar(rng_bulk_t* b, double* out, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            rng_t lane = {{b->s[0][j], b->s[1][j], b->s[2][j], b->s[3][j]}};
+            uint64_t x = rng_next(&lane);
+            for (int w = 0; w < 4; w++)
+                b->s[w][j] = lane.s[w];
+            if (i + (size_t)j < n)
+                out[i + (size_t)j] = bits_to_unit(x);
+        }
+    }
+}
+
+#ifdef RNG_X86
+__attribute__((target("avx2"))) static inline __m256i rotl_avx2(__m256i x, int k) {
+    return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+}
+
+/* --- avx2: the four lanes advance together, one vector per state word --- */
+__attribute__((target("avx2"))) static void fill_avx2(rng_bulk_t* b, double* out, size_t n) {
+    __m256i s0 = _mm256_load_si256((const __m256i*)b->s[0]);
+    __m256i s1 = _mm256_load_si256((const __m256i*)b->s[1]);
+    __m256i s2 = _mm256_load_si256((const __m256i*)b->s[2]);
+    __m256i s3 = _mm256_load_si256((const __m256i*)b->s[3]);
+    const __m256i one = _mm256_set1_epi64x(0x3ff0000000000000LL);
+    const __m256d unit = _mm256_set1_pd(1.0);
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i x = _mm256_add_epi64(rotl_avx2(_mm256_add_epi64(s0, s3), 23), s0);
+        __m256i t = _mm256_slli_epi64(s1, 17);
+        s2 = _mm256_xor_si256(s2, s0);
+        s3 = _mm256_xor_si256(s3, s1);
+        s1 = _mm256_xor_si256(s1, s2);
+        s0 = _mm256_xor_si256(s0, s3);
+        s2 = _mm256_xor_si256(s2, t);
+        s3 = rotl_avx2(s3, 45);
+        __m256i bits = _mm256_or_si256(_mm256_srli_epi64(x, 12), one);
+        __m256d d = _mm256_sub_pd(_mm256_castsi256_pd(bits), unit);
+        if (i + 4 <= n) {
+            _mm256_storeu_pd(out + i, d);
+        } else {
+            double tail[4];
+            _mm256_storeu_pd(tail, d);
+            memcpy(out + i, tail, (n - i) * sizeof(double));
+        }
+    }
+    _mm256_store_si256((__m256i*)b->s[0], s0);
+    _mm256_store_si256((__m256i*)b->s[1], s1);
+    _mm256_store_si256((__m256i*)b->s[2], s2);
+    _mm256_store_si256((__m256i*)b->s[3], s3);
+    _mm256_zeroupper();
+}
+#endif
+
+static void (*fill_kernel)(rng_bulk_t* b, double* out, size_t n) = fill_scalar;
+static const char* fill_name = "scalar";
+
+void rng_bulk_init(rng_bulk_t* b, rng_t* r) {
+    for (int j = 0; j < 4; j++) {
+        for (int w = 0; w < 4; w++)
+            b->s[w][j] = r->s[w];
+        rng_jump(r);
+    }
+}
+
+void rng_bulk_fill(rng_bulk_t* b, double* out, size_t n) {
+    fill_kernel(b, out, n);
+}
+
+const char* rng_kernel(void) {
+    return fill_name;
+}
+
+void rng_init(uint64_t seed, uint64_t salt) {
+    if (seed == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        seed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 20) ^ ((uint64_t)getpid() << 40);
+    }
+    seed_used = seed;
+    uint64_t mix = seed;
+    rng_seed(&root, splitmix64(&mix) ^ salt);
+    start_epoch(&root);
+
+    fill_kernel = fill_scalar;
+    fill_name = "scalar";
+#ifdef RNG_X86
+    if (vec_has_avx2()) {
+        fill_kernel = fill_avx2;
+        fill_name = "avx2";
+    }
+#endif
+}
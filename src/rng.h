@@ -0,0 +1,88 @@
+/*
+  rng.h - xoshiro256++ random numbers, one stream per thread
+  - rng_init seeds the process from SEED in the config block (0 = from the clock and pid); the
+    same seed, starting iteration and call sequence reproduce the same draws
+  - every thread that calls rng_local gets its own stream, 2^128 draws apart from the others, so
+    nothing is shared or locked; a forked worker moves to a family of its own with rng_branch
+  - rng_bulk_t fills arrays of uniform doubles four lanes at a time (avx2 when vec selected it);
+    both kernels produce the same numbers. the batch draws (replay minibatches, fresh mlp
+    weights) take theirs from the calling thread's rng_local_bulk
+*/
+#ifndef AGI_RNG_H
+#define AGI_RNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t s[4];
+} rng_t;
+
+/* 'seed' expanded with splitmix64, so any value (0 included) gives a usable state */
+void rng_seed(rng_t* r, uint64_t seed);
+/* advance 2^128 draws: the start of the next stream */
+void rng_jump(rng_t* r);
+/* advance 2^192 draws: the start of the next family of streams */
+void rng_long_jump(rng_t* r);
+
+static inline uint64_t rng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(rng_t* r) {
+    uint64_t* s = r->s;
+    uint64_t out = rng_rotl(s[0] + s[3], 23) + s[0];
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return out;
+}
+
+/* uniform in [0, 1), 53 random bits */
+static inline double rng_uniform(rng_t* r) {
+    return (double)(rng_next(r) >> 11) * 0x1p-53;
+}
+
+/* uniform in [0, n) without modulo bias, n > 0 */
+static inline uint64_t rng_below(rng_t* r, uint64_t n) {
+    uint64_t threshold = -n % n;
+    for (;;) {
+        __extension__ unsigned __int128 m = (unsigned __int128)rng_next(r) * n;
+        if ((uint64_t)m >= threshold)
+            return (uint64_t)(m >> 64);
+    }
+}
+
+/* seed the process (0 = from the clock and pid) and pick the bulk kernel (call after vec_init).
+   'salt' keeps generations that exec each other from replaying the parent's draws; pass the
+   iteration the generation starts at. other threads pick up the new seed on their next
+   rng_local, which must not run concurrently with this (nor with rng_branch) */
+void rng_init(uint64_t seed, uint64_t salt);
+/* the seed in use, after the clock fallback */
+uint64_t rng_seed_used(void);
+/* the calling thread's stream */
+rng_t* rng_local(void);
+/* for a forked child: move the calling thread (and later threads) to stream family 'family',
+   disjoint from the parent's and every other family, so siblings never draw the same numbers */
+void rng_branch(uint64_t family);
+
+/* --- bulk: four interleaved generators, out[4i + j] comes from lane j --- */
+typedef struct {
+    _Alignas(32) uint64_t s[4][4]; // s[word][lane], so a word of every lane is one vector
+} rng_bulk_t;
+
+/* four lanes from consecutive streams starting at 'r', which is left at the stream after them */
+void rng_bulk_init(rng_bulk_t* b, rng_t* r);
+/* n uniform doubles in [0, 1) with 52 random bits; a tail short of four lanes wastes the rest */
+void rng_bulk_fill(rng_bulk_t* b, double* out, size_t n);
+/* the calling thread's bulk generator: four more streams of its family, picked up again after
+   rng_init or rng_branch as rng_local is */
+rng_bulk_t* rng_local_bulk(void);
+/* name of the selected bulk kernel */
+const char* rng_kernel(void);
+
+#endif
@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include "snapshot.h"
+#include "stm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+const char* const snapshot_mode_names[SNAPSHOT_MODE_COUNT] = {"off", "auto", "diff"};
+
+/* set once FICLONE has failed for want of support, so auto stops asking */
+static bool no_reflink = false;
+
+static uint64_t micros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void path_of(char* out, size_t cap, const char* stm_path, const char* suffix) {
+    snprintf(out, cap, "%s%s", stm_path, suffix);
+}
+
+static size_t page_size(void) {
+    long p = sysconf(_SC_PAGESIZE);
+    return p > 0 ? (size_t)p : 4096;
+}
+
+/* clone the whole arena file into 'dst'; false (and errno says why) if the filesystem won't */
+static bool take_reflink(const char* stm_path, int dst) {
+    int src = open(stm_path, O_RDONLY);
+    if (src < 0)
+        return false;
+    bool ok = ioctl(dst, FICLONE, src) == 0;
+    int err = errno;
+    close(src);
+    errno = err;
+    return ok;
+}
+
+/* bring the snapshot file up to the live arena a page at a time, writing only what differs */
+static bool take_diff(int fd, snapshot_stats_t* st) {
+    uint64_t size = stm->file_size;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || ((uint64_t)sb.st_size != size && ftruncate(fd, (off_t)size) != 0)) {
+        perror("ftruncate(snapshot)");
+        return false;
+    }
+    unsigned char* snap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (snap == MAP_FAILED) {
+        perror("mmap(snapshot)");
+        return false;
+    }
+    const unsigned char* live = (const unsigned char*)stm;
+    size_t page = page_size();
+    for (uint64_t off = 0; off < size; off += page) {
+        size_t n = size - off < page ? (size_t)(size - off) : page;
+        st->total++;
+        if (memcmp(snap + off, live + off, n) != 0) {
+            memcpy(snap + off, live + off, n);
+            st->pages++;
+        }
+    }
+    munmap(snap, size);
+    return true;
+}
+
+bool snapshot_take(int mode, const char* stm_path, const void* meta, size_t len,
+                   snapshot_stats_t* st) {
+    snapshot_stats_t local;
+    if (!st)
+        st = &local;
+    memset(st, 0, sizeof(*st));
+    if (mode == SNAPSHOT_OFF || !stm)
+        return false;
+    uint64_t t0 = micros();
+    char path[4096], meta_path[4096], tmp[4096];
+    path_of(path, sizeof(path), stm_path, ".snap");
+    path_of(meta_path, sizeof(meta_path), stm_path, ".snap.meta");
+    path_of(tmp, sizeof(tmp), stm_path, ".snap.meta.tmp");
+    // a record left from an older snapshot must not vouch for a half-written one
+    unlink(meta_path);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("open(snapshot)");
+        return false;
+    }
+    bool ok = false;
+    if (mode == SNAPSHOT_AUTO && !no_reflink) {
+        ok = take_reflink(stm_path, fd);
+        if (!ok && (errno == EOPNOTSUPP || errno == EXDEV || errno == EINVAL || errno == ENOTTY))
+            no_reflink = true;
+        st->reflinked = ok;
+    }
+    if (!ok)
+        ok = take_diff(fd, st);
+    // the data has to be on disk before a record says it is a snapshot
+    if (ok && fdatasync(fd) != 0) {
+        perror("fdatasync(snapshot)");
+        ok = false;
+    }
+    close(fd);
+    if (!ok)
+        return false;
+    FILE* f = fopen(tmp, "wb");
+    if (!f) {
+        perror("fopen(snapshot meta)");
+        return false;
+    }
+    ok = fwrite(meta, 1, len, f) == len;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, meta_path) != 0) {
+        perror("write(snapshot meta)");
+        unlink(tmp);
+        return false;
+    }
+    st->micros = micros() - t0;
+    return true;
+}
+
+bool snapshot_meta(const char* stm_path, void* meta, size_t len) {
+    char meta_path[4096];
+    path_of(meta_path, sizeof(meta_path), stm_path, ".snap.meta");
+    FILE* f = fopen(meta_path, "rb");
+    if (!f)
+        return false;
+    bool ok = fread(meta, 1, len, f) == len && fgetc(f) == EOF;
+    fclose(f);
+    return ok;
+}
+
+static const stm_section_t* live_section(const char* name) {
+    for (uint64_t i = 0; i < stm->n_sections; i++)
+        if (strncmp(stm->sections[i].name, name, STM_NAME_LEN) == 0)
+            return &stm->sections[i];
+    return NULL;
+}
+
+bool snapshot_restore(const char* stm_path, snapshot_stats_t* st) {
+    snapshot_stats_t local;
+    if (!st)
+        st = &local;
+    memset(st, 0, sizeof(*st));
+    if (!stm)
+        return false;
+    uint64_t t0 = micros();
+    char path[4096];
+    path_of(path, sizeof(path), stm_path, ".snap");
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (uint64_t)sb.st_size < sizeof(stm_header_t)) {
+        close(fd);
+        return false;
+    }
+    uint64_t size = (uint64_t)sb.st_size;
+    const unsigned char* snap = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (snap == MAP_FAILED) {
+        perror("mmap(snapshot)");
+        return false;
+    }
+    const stm_header_t* h = (const stm_header_t*)snap;
+    bool same = h->magic == STM_MAGIC && h->version == STM_VERSION &&
+                h->n_sections <= STM_MAX_SECTIONS;
+    // every durable section must still be where, and as large as, it was
+    for (uint64_t i = 0; same && i < h->n_sections; i++) {
+        const stm_section_t* s = &h->sections[i];
+        if (!(s->flags & STM_DURABLE))
+            continue;
+        const stm_section_t* l = live_section(s->name);
+        same = l && l->offset == s->offset && l->size == s->size && l->layout == s->layout &&
+               s->offset + s->size <= size && l->offset + l->size <= stm->file_size;
+    }
+    if (!same) {
+        munmap((void*)snap, size);
+        return false;
+    }
+    unsigned char* live = (unsigned char*)stm;
+    size_t page = page_size();
+    for (uint64_t i = 0; i < h->n_sections; i++) {
+        const stm_section_t* s = &h->sections[i];
+        if (!(s->flags & STM_DURABLE))
+            continue;
+        for (uint64_t off = s->offset; off < s->offset + s->size; off += page) {
+            size_t n = s->offset + s->size - off < page ? (size_t)(s->offset + s->size - off)
+                                                        : page;
+            st->total++;
+            if (memcmp(live + off, snap + off, n) != 0) {
+                memcpy(live + off, snap + off, n);
+                st->pages++;
+            }
+        }
+    }
+    munmap((void*)snap, size);
+    st->micros = micros() - t0;
+    return true;
+}
+
+void snapshot_drop(const char* stm_path) {
+    char meta_path[4096];
+    path_of(meta_path, sizeof(meta_path), stm_path, ".snap.meta");
+    unlink(meta_path);
+}
@@ -0,0 +1,47 @@
+/*
+  snapshot.h - point-in-time copies of the STM arena, for rolling a bad generation back
+  - a snapshot is a second file next to the arena (<stm path>.snap) plus a small record of the
+    caller's (<stm path>.snap.meta) saying why it was taken; both outlive an exec
+  - SNAPSHOT=auto clones the file with FICLONE where the filesystem shares extents (btrfs, xfs,
+    ...), which costs metadata only. elsewhere, and with SNAPSHOT=diff, the previous snapshot is
+    patched in place: only the pages that differ from the live arena are written
+  - a restore compares the live copy of every durable section with the snapshot and copies back
+    just the pages that differ, so it writes O(changed pages). it needs the arena's layout to be
+    the snapshot's (no section moved or grown since)
+  - the arena must be quiet while either runs: no hogwild workers
+*/
+#ifndef AGI_SNAPSHOT_H
+#define AGI_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    SNAPSHOT_OFF,
+    SNAPSHOT_AUTO, // FICLONE if the filesystem can, else a page diff
+    SNAPSHOT_DIFF, // always the page diff
+} snapshot_mode_t;
+
+#define SNAPSHOT_MODE_COUNT 3
+extern const char* const snapshot_mode_names[SNAPSHOT_MODE_COUNT];
+
+typedef struct {
+    bool reflinked;  // the last take was a FICLONE
+    uint64_t pages;  // pages written by the last take (diff) or restore
+    uint64_t total;  // pages looked at
+    uint64_t micros; // how long it took
+} snapshot_stats_t;
+
+/* snapshot the arena mapped from 'stm_path' with 'meta' (len bytes) as its record */
+bool snapshot_take(int mode, const char* stm_path, const void* meta, size_t len,
+                   snapshot_stats_t* st);
+/* the record of the snapshot of 'stm_path', false if there is none (or of another length) */
+bool snapshot_meta(const char* stm_path, void* meta, size_t len);
+/* bring the live durable sections back to the snapshot; false if there is none or its layout
+   no longer matches the arena's, and nothing is changed then */
+bool snapshot_restore(const char* stm_path, snapshot_stats_t* st);
+/* forget the record; the data file stays as the base of the next diff */
+void snapshot_drop(const char* stm_path);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+  state.h - the learner's state as laid out in the STM sections
+  - every section records the layout it was written with; bump the *_LAYOUT constant and add a
+    descriptor table in migrate.c whenever a struct below changes
+*/
+#ifndef AGI_STATE_H
+#define AGI_STATE_H
+
+#include <stdint.h>
+
+/* section "core": the learner's scalar state, durable and on its own cache line */
+#define CORE_LAYOUT 0
+typedef struct {
+    uint64_t iter;
+    uint64_t n_features; // live length of the "weights" section
+    double bias;
+    double running_reward;
+} stm_core_t;
+
+/* section "optim": the minibatch optimizer's scalar state, durable. the per-weight moments live
+   in sections "optim_m" and "optim_v", n_features doubles each and durable like "weights" */
+#define OPTIM_LAYOUT 0
+typedef struct {
+    uint64_t steps; // minibatch updates applied (Adam's bias correction counts these)
+    double bias_m;  // the bias's first and second moments
+    double bias_v;
+    uint64_t reserved;
+} stm_optim_t;
+
+/* section "mlp": the shape of the multi-layer perceptron, durable. its parameters take the place
+   of the linear weights in "weights": per layer, the weight matrix (out x in, row-major) then
+   the biases, from the input layer to the single linear output */
+#define MLP_LAYOUT 0
+#define MLP_MAX_HIDDEN 4
+typedef struct {
+    uint64_t n_hidden; // hidden layers, 0 = the linear learner
+    uint64_t n_inputs; // the feature count it was built for
+    uint64_t width[MLP_MAX_HIDDEN];
+    uint64_t activation; // mlp_activation_t
+    uint64_t n_params;   // doubles of "weights" in use
+} stm_mlp_t;
+
+/* section "stats": observation only, not covered by commits */
+#define STATS_LAYOUT 1
+typedef struct {
+    uint64_t overruns;  // tick overruns summed over every generation
+    uint64_t mutations; // mutations whose trial ended with them kept, over every generation
+    uint64_t rollbacks; // and those rolled back
+    char scratch[256];
+} stm_stats_t;
+
+/* section "replay": an experience ring (see replay.h), not covered by commits. this header is
+   followed by structure-of-arrays storage for 'capacity' samples: reward[capacity],
+   iter[capacity], a priority sum tree of 2 * capacity doubles (leaves at [capacity, 2 * capacity)),
+   then the feature vectors, n_features doubles each. a section written with another layout or
+   shape is cleared rather than migrated: it only holds past samples */
+#define REPLAY_LAYOUT 1
+typedef struct {
+    uint64_t capacity;   // slots, a power of two
+    uint64_t n_features; // stride of the stored feature vectors
+    uint64_t head;       // next slot to overwrite
+    uint64_t count;      // filled slots
+    double max_priority; // what a new sample starts with, so it is replayed at least once soon
+    uint64_t reserved[3];
+} stm_replay_t;
+
+/* section "wal": how far the write-ahead log (wal.h) had got as of the live state, durable so
+   every commit records exactly which log records it already contains */
+#define WAL_LAYOUT 0
+typedef struct {
+    uint64_t lsn;    // sequence number of the last record appended
+    uint64_t offset; // log file offset just past it
+    uint64_t reserved[2];
+} stm_wal_t;
+
+/* section "restart": when each phase of the latest self-modification cycle was reached (see
+   restart.h), observation only and not covered by commits. stamps are CLOCK_MONOTONIC
+   nanoseconds, 0 for a phase the cycle did not pass */
+#define RESTART_LAYOUT 0
+#define RESTART_PHASES 7
+typedef struct {
+    uint64_t stamp[RESTART_PHASES];
+    uint64_t pending; // a cycle is under way; the first iteration after it closes it
+    uint64_t cycles;  // cycles closed
+    uint64_t sum[RESTART_PHASES]; // nanoseconds spent reaching each phase, over every cycle
+} stm_restart_t;
+
+#endif
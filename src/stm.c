@@ -0,0 +1,623 @@
+#define _GNU_SOURCE
+#include "stm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/magic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#define STM_INITIAL_SIZE (64 * 1024)
+#define FNV_PRIME 0x100000001b3ULL
+
+stm_header_t* stm = NULL;
+uint64_t stm_remaps = 0;
+static int stm_fd = -1;
+static bool stm_is_private = false; // see stm_make_private
+
+const char* const stm_huge_names[STM_HUGE_COUNT] = {"off", "advise", "hugetlb"};
+
+static stm_tuning_t tuning = {STM_HUGE_OFF, false, false};
+static uint64_t granule = 0;      // the huge page size when the file is on hugetlbfs, else 0
+static uint64_t locked = 0;       // bytes mlock'd (ranges may overlap), 0 = nothing to unlock
+static int lock_errno = 0;        // why the last mlock failed
+static int advise_errno = 0;      // why MADV_HUGEPAGE was refused
+
+static uint64_t align_up(uint64_t v) {
+    return (v + STM_ALIGN - 1) & ~(uint64_t)(STM_ALIGN - 1);
+}
+
+static unsigned char* stm_base(void) {
+    return (unsigned char*)stm;
+}
+
+static size_t page_size(void) {
+    long p = sysconf(_SC_PAGESIZE);
+    return p > 0 ? (size_t)p : 4096;
+}
+
+/* fnv-1a style, a 64-bit word at a time so checksumming large sections stays cheap */
+uint64_t stm_hash(uint64_t h, const void* data, size_t len) {
+    const unsigned char* p = data;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        h = (h ^ w) * FNV_PRIME;
+        h ^= h >> 29;
+    }
+    for (; i < len; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static stm_section_t* find_section(const char* name) {
+    for (uint64_t i = 0; i < stm->n_sections; i++) {
+        if (strncmp(stm->sections[i].name, name, STM_NAME_LEN) == 0)
+            return &stm->sections[i];
+    }
+    return NULL;
+}
+
+/* --- commits --- */
+
+/* in this process only: which write of each section each commit slot holds, and digests of the
+   shadow copies, so a commit copies and hashes just the sections that changed. both start out
+   unknown, so the first two commits after opening copy everything */
+static uint64_t live_gen[STM_MAX_SECTIONS];    // bumped by stm_dirty
+static uint64_t slot_gen[2][STM_MAX_SECTIONS]; // live_gen as of the slot's copy
+static uint64_t digest[2][STM_MAX_SECTIONS];
+static bool digest_ok[2][STM_MAX_SECTIONS];
+static bool unsynced = false; // the newest commit was MS_ASYNC and may not be on disk yet
+
+static void forget_slots(void) {
+    for (int i = 0; i < STM_MAX_SECTIONS; i++) {
+        live_gen[i] = 1;
+        slot_gen[0][i] = slot_gen[1][i] = 0;
+        digest_ok[0][i] = digest_ok[1][i] = false;
+    }
+    unsynced = false;
+}
+
+static uint64_t section_digest(int k, uint64_t i) {
+    if (!digest_ok[k][i]) {
+        const stm_section_t* s = &stm->sections[i];
+        digest[k][i] = stm_hash(STM_HASH_SEED, stm_base() + s->shadow[k], s->size);
+        digest_ok[k][i] = true;
+    }
+    return digest[k][i];
+}
+
+static uint64_t slot_checksum(int k, uint64_t seq) {
+    uint64_t h = stm_hash(STM_HASH_SEED, &seq, sizeof(seq));
+    for (uint64_t i = 0; i < stm->n_sections; i++) {
+        const stm_section_t* s = &stm->sections[i];
+        if (!(s->flags & STM_DURABLE))
+            continue;
+        uint64_t d = section_digest(k, i);
+        h = stm_hash(h, s->name, STM_NAME_LEN);
+        h = stm_hash(h, &s->size, sizeof(s->size));
+        h = stm_hash(h, &stm->commit[k].layout[i], sizeof(uint64_t));
+        h = stm_hash(h, &d, sizeof(d));
+    }
+    return h;
+}
+
+static bool slot_valid(int k) {
+    const stm_commit_t* c = &stm->commit[k];
+    return c->seq != 0 && c->checksum == slot_checksum(k, c->seq);
+}
+
+/* msync a range of the file, widened to whole pages */
+static void sync_range(uint64_t off, uint64_t len, int flags) {
+    uint64_t page = granule ? granule : page_size();
+    uint64_t lo = off & ~(page - 1);
+    msync(stm_base() + lo, off + len - lo, flags);
+}
+
+static void sync_slot(int k, int flags) {
+    for (uint64_t i = 0; i < stm->n_sections; i++) {
+        const stm_section_t* s = &stm->sections[i];
+        if (s->flags & STM_DURABLE)
+            sync_range(s->shadow[k], s->size, flags);
+    }
+    sync_range(0, sizeof(stm_header_t), flags);
+}
+
+void stm_dirty(const void* live) {
+    uint64_t off = (uint64_t)((const unsigned char*)live - stm_base());
+    for (uint64_t i = 0; i < stm->n_sections; i++) {
+        const stm_section_t* s = &stm->sections[i];
+        if (off >= s->offset && off < s->offset + s->size) {
+            live_gen[i]++;
+            return;
+        }
+    }
+}
+
+void stm_commit_dirty(int flags) {
+    if (stm_is_private)
+        return;
+    uint64_t seq = stm->seq + 1;
+    int k = (int)(seq & 1);
+    // slot k is about to be overwritten, so the other one must really be the last good commit
+    if (unsynced)
+        sync_slot(1 - k, MS_SYNC);
+    // the copies first: only then does the header name them as a commit
+    for (uint64_t i = 0; i < stm->n_sections; i++) {
+        const stm_section_t* s = &stm->sections[i];
+        if (!(s->flags & STM_DURABLE) || slot_gen[k][i] == live_gen[i])
+            continue;
+        memcpy(stm_base() + s->shadow[k], stm_base() + s->offset, s->size);
+        slot_gen[k][i] = live_gen[i];
+        digest_ok[k][i] = false;
+        sync_range(s->shadow[k], s->size, flags);
+    }
+    for (uint64_t i = 0; i < stm->n_sections; i++)
+        stm->commit[k].layout[i] = stm->sections[i].layout;
+    stm->commit[k].seq = seq;
+    stm->commit[k].checksum = slot_checksum(k, seq);
+    stm->seq = seq;
+    sync_range(0, sizeof(stm_header_t), flags);
+    unsynced = flags != MS_SYNC;
+}
+
+void stm_commit(int flags) {
+    if (!stm_is_private) {
+        for (uint64_t i = 0; i < stm->n_sections; i++)
+            live_gen[i]++;
+    }
+    stm_commit_dirty(flags);
+}
+
+/* --- tuning --- */
+/* read every page so none faults later; reading leaves the shared pages clean */
+static void populate(void) {
+#ifdef MADV_POPULATE_READ
+    if (madvise(stm, stm->file_size, MADV_POPULATE_READ) == 0)
+        return;
+#endif
+    size_t step = granule ? granule : page_size();
+    const volatile unsigned char* p = (const unsigned char*)stm;
+    for (uint64_t off = 0; off < stm->file_size; off += step)
+        (void)p[off];
+}
+
+/* lock the header and the live copy of every section, page-aligned; the shadows are left to
+   the page cache */
+static void lock_sections(void) {
+    if (locked) {
+        munlock(stm, stm->file_size);
+        locked = 0;
+    }
+    // hugetlb pages are never paged out, and smaps would not count them as locked anyway
+    if (!tuning.lock || stm_is_private || granule)
+        return;
+    uintptr_t page = page_size();
+    lock_errno = 0;
+    // the header too: every commit writes it
+    if (mlock(stm, page) != 0) {
+        lock_errno = errno;
+        return;
+    }
+    locked = page;
+    for (uint64_t i = 0; i < stm->n_sections; i++) {
+        const stm_section_t* s = &stm->sections[i];
+        uintptr_t lo = (uintptr_t)(stm_base() + s->offset) & ~(page - 1);
+        uintptr_t hi = ((uintptr_t)(stm_base() + s->offset + s->size) + page - 1) & ~(page - 1);
+        if (mlock((void*)lo, hi - lo) != 0) {
+            lock_errno = errno; // RLIMIT_MEMLOCK, most likely; the rest stays unlocked
+            return;
+        }
+        locked += hi - lo;
+    }
+}
+
+/* bring the mapping in line with 'tuning'; after every map, remap and new section */
+static void apply_tuning(bool prefault) {
+    if (!stm)
+        return;
+    advise_errno = 0;
+    if (tuning.huge != STM_HUGE_OFF && !granule &&
+        madvise(stm, stm->file_size, MADV_HUGEPAGE) != 0)
+        advise_errno = errno;
+    if (prefault && tuning.prefault)
+        populate();
+    lock_sections();
+}
+
+void stm_tune(const stm_tuning_t* t) {
+    bool more = t->prefault && !tuning.prefault;
+    if (stm && tuning.huge != STM_HUGE_OFF && t->huge == STM_HUGE_OFF && !granule)
+        madvise(stm, stm->file_size, MADV_NOHUGEPAGE);
+    tuning = *t;
+    apply_tuning(more);
+}
+
+/* what smaps says of the mapping: its page size, and how much of it sits in huge pages and is
+   locked */
+static void read_smaps(uint64_t* page_kb, uint64_t* huge_kb, uint64_t* locked_kb) {
+    FILE* f = fopen("/proc/self/smaps", "r");
+    if (!f)
+        return;
+    static const char* const fields[] = {"AnonHugePages:", "ShmemPmdMapped:", "FilePmdMapped:",
+                                         "Shared_Hugetlb:", "Private_Hugetlb:"};
+    uintptr_t lo = (uintptr_t)stm, hi = lo + stm->file_size;
+    bool inside = false;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        uintptr_t a, b;
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &a, &b) == 2) {
+            inside = a >= lo && b <= hi;
+            continue;
+        }
+        if (!inside)
+            continue;
+        uint64_t v;
+        if (sscanf(line, "KernelPageSize: %" SCNu64, &v) == 1)
+            *page_kb = v;
+        else if (sscanf(line, "Locked: %" SCNu64, &v) == 1)
+            *locked_kb += v;
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            size_t n = strlen(fields[i]);
+            if (strncmp(line, fields[i], n) == 0 && sscanf(line + n, "%" SCNu64, &v) == 1)
+                *huge_kb += v;
+        }
+    }
+    fclose(f);
+}
+
+void stm_report(char* out, size_t len) {
+    if (!stm) {
+        snprintf(out, len, "not mapped");
+        return;
+    }
+    uint64_t page_kb = page_size() / 1024, huge_kb = 0, locked_kb = 0;
+    read_smaps(&page_kb, &huge_kb, &locked_kb);
+    struct rusage ru;
+    long majflt = getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_majflt : -1;
+    char lock[64];
+    if (granule)
+        snprintf(lock, sizeof(lock), "resident");
+    else
+        snprintf(lock, sizeof(lock), "%s (%" PRIu64 " kB)", tuning.lock ? "on" : "off", locked_kb);
+    int n = snprintf(out, len,
+                     "%" PRIu64 " kB mapped in %" PRIu64 " kB pages, huge=%s (%" PRIu64
+                     " kB huge%s), lock=%s, prefault=%s, %ld major faults",
+                     stm->file_size / 1024, page_kb, stm_huge_names[tuning.huge], huge_kb,
+                     granule ? ", hugetlbfs: lost on reboot" : "", lock,
+                     tuning.prefault ? "on" : "off", majflt);
+    if (n < 0 || (size_t)n >= len)
+        return;
+    if (tuning.huge == STM_HUGE_HUGETLB && !granule)
+        n += snprintf(out + n, len - (size_t)n, "; the file is not on hugetlbfs, advising");
+    else if (advise_errno)
+        n += snprintf(out + n, len - (size_t)n, "; madvise: %s", strerror(advise_errno));
+    if (lock_errno && (size_t)n < len) {
+        struct rlimit rl;
+        getrlimit(RLIMIT_MEMLOCK, &rl);
+        snprintf(out + n, len - (size_t)n, "; mlock: %s (RLIMIT_MEMLOCK %" PRIu64 " kB)",
+                 strerror(lock_errno),
+                 rl.rlim_cur == RLIM_INFINITY ? UINT64_MAX : (uint64_t)rl.rlim_cur / 1024);
+    }
+}
+
+/* --- mapping --- */
+static bool map_fd(uint64_t size) {
+    int flags = MAP_SHARED | (tuning.prefault ? MAP_POPULATE : 0);
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, stm_fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap(stm)");
+        if (granule)
+            fprintf(stderr, "[agi] stm: %lu MB of huge pages needed, see vm.nr_hugepages\n",
+                    size >> 20);
+        return false;
+    }
+    stm = p;
+    stm_remaps++;
+    return true;
+}
+
+/* make the file and the mapping at least 'size' bytes, doubling to keep growth rare */
+static bool grow_file(uint64_t size) {
+    uint64_t old = stm->file_size;
+    if (size <= old)
+        return true;
+    if (stm_is_private) {
+        fprintf(stderr, "[agi] stm: cannot grow a private mapping\n");
+        return false;
+    }
+    uint64_t next = old;
+    while (next < size)
+        next *= 2;
+    if (ftruncate(stm_fd, (off_t)next) != 0) {
+        perror("ftruncate(stm)");
+        return false;
+    }
+    // mremap wants a single vma, and the locked ranges split the mapping into several
+    if (locked) {
+        munlock(stm, old);
+        locked = 0;
+    }
+    void* p;
+    if (granule) {
+        // hugetlb mappings cannot grow in place; the file holds everything, so map it afresh
+        p = mmap(NULL, next, PROT_READ | PROT_WRITE, MAP_SHARED, stm_fd, 0);
+        if (p != MAP_FAILED)
+            munmap(stm, old);
+    } else {
+        p = mremap(stm, old, next, MREMAP_MAYMOVE);
+    }
+    if (p == MAP_FAILED) {
+        perror("mremap(stm)");
+        return false;
+    }
+    stm = p;
+    stm->file_size = next;
+    stm_remaps++;
+    apply_tuning(true);
+    return true;
+}
+
+/* throw away whatever is in the file and start an empty arena */
+static bool reset_file(void) {
+    if (stm)
+        munmap(stm, stm->file_size);
+    stm = NULL;
+    locked = 0;
+    // hugetlbfs only takes whole huge pages
+    uint64_t size = granule > STM_INITIAL_SIZE ? granule : STM_INITIAL_SIZE;
+    if (ftruncate(stm_fd, 0) != 0 || ftruncate(stm_fd, (off_t)size) != 0) {
+        perror("ftruncate(stm)");
+        return false;
+    }
+    if (!map_fd(size))
+        return false;
+    stm->magic = STM_MAGIC;
+    stm->version = STM_VERSION;
+    stm->file_size = size;
+    stm->used = align_up(sizeof(stm_header_t));
+    msync(stm, size, MS_SYNC);
+    apply_tuning(false);
+    forget_slots();
+    return true;
+}
+
+/* a copy of a section: aligned, past the header and inside what the allocator handed out */
+static bool copy_in_bounds(uint64_t off, uint64_t size) {
+    return off % STM_ALIGN == 0 && off >= align_up(sizeof(stm_header_t)) &&
+           off <= stm->used - size;
+}
+
+/* a header that can be trusted enough to look at the commits */
+static bool header_sane(uint64_t actual_size) {
+    if (stm->magic != STM_MAGIC || stm->version != STM_VERSION)
+        return false;
+    if (stm->n_sections > STM_MAX_SECTIONS || stm->used > actual_size)
+        return false;
+    for (uint64_t i = 0; i < stm->n_sections; i++) {
+        const stm_section_t* s = &stm->sections[i];
+        if (s->size > stm->used || !copy_in_bounds(s->offset, s->size))
+            return false;
+        // the commits are checked and restored from the shadows, wherever they ended up
+        if ((s->flags & STM_DURABLE) &&
+            (!copy_in_bounds(s->shadow[0], s->size) || !copy_in_bounds(s->shadow[1], s->size)))
+            return false;
+    }
+    return true;
+}
+
+stm_open_t stm_open(const char* path) {
+    stm_fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (stm_fd < 0) {
+        perror("open(stm)");
+        return STM_ERROR;
+    }
+    struct stat st;
+    if (fstat(stm_fd, &st) != 0) {
+        perror("fstat(stm)");
+        return STM_ERROR;
+    }
+    struct statfs fs;
+    granule = fstatfs(stm_fd, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC ? (uint64_t)st.st_blksize
+                                                                          : 0;
+    uint64_t size = (uint64_t)st.st_size;
+    if (size < STM_INITIAL_SIZE || (granule && size % granule != 0))
+        return reset_file() ? STM_FRESH : STM_ERROR;
+    if (!map_fd(size))
+        return STM_ERROR;
+    if (!header_sane(size)) {
+        fprintf(stderr, "[agi] stm: unrecognised layout, starting fresh\n");
+        return reset_file() ? STM_FRESH : STM_ERROR;
+    }
+    // a crash between ftruncate and the header update leaves the file larger than recorded
+    stm->file_size = size;
+    apply_tuning(false);
+    forget_slots();
+
+    int k = -1;
+    for (int i = 0; i < 2; i++) {
+        if (slot_valid(i) && (k < 0 || stm->commit[i].seq > stm->commit[k].seq))
+            k = i;
+    }
+    if (k < 0) {
+        fprintf(stderr, "[agi] stm: no valid commit (torn write?), starting fresh\n");
+        return reset_file() ? STM_FRESH : STM_ERROR;
+    }
+
+    // anything written after the newest good commit may be torn, so always resume from it
+    bool rolled_back = false;
+    for (uint64_t i = 0; i < stm->n_sections; i++) {
+        stm_section_t* s = &stm->sections[i];
+        if (!(s->flags & STM_DURABLE))
+            continue;
+        if (s->layout != stm->commit[k].layout[i]) {
+            s->layout = stm->commit[k].layout[i];
+            rolled_back = true;
+        }
+        unsigned char* live = stm_base() + s->offset;
+        const unsigned char* shadow = stm_base() + s->shadow[k];
+        if (memcmp(live, shadow, s->size) != 0) {
+            memcpy(live, shadow, s->size);
+            rolled_back = true;
+        }
+    }
+    if (rolled_back)
+        fprintf(stderr, "[agi] stm: rolled back to commit seq=%lu\n", stm->commit[k].seq);
+    stm->seq = stm->commit[k].seq;
+    return STM_RESUMED;
+}
+
+bool stm_make_private(void) {
+    // MAP_FIXED over the same range keeps every section pointer valid
+    void* p = mmap(stm, stm->file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, stm_fd,
+                   0);
+    if (p == MAP_FAILED) {
+        perror("mmap(stm, private)");
+        return false;
+    }
+    stm_is_private = true;
+    locked = 0; // the new mapping is not locked
+    return true;
+}
+
+void stm_close(void) {
+    if (stm)
+        munmap(stm, stm->file_size);
+    if (stm_fd >= 0)
+        close(stm_fd);
+    stm = NULL;
+    stm_fd = -1;
+    locked = 0;
+}
+
+/* --- sections --- */
+void* stm_section(const char* name, uint64_t* size) {
+    const stm_section_t* s = find_section(name);
+    if (!s)
+        return NULL;
+    if (size)
+        *size = s->size;
+    return stm_base() + s->offset;
+}
+
+uint64_t stm_layout(const char* name) {
+    const stm_section_t* s = find_section(name);
+    return s ? s->layout : 0;
+}
+
+void stm_set_layout(const char* name, uint64_t layout) {
+    stm_section_t* s = find_section(name);
+    if (s)
+        s->layout = layout;
+}
+
+/* the lowest offset where 'len' bytes overlap no copy the header refers to, live or shadow, else
+   the end of the last copy. nothing else is allocated, so space a section moved out of is free
+   again once the header stops referring to it, and the file only grows for what does not fit */
+static uint64_t find_space(uint64_t len) {
+    struct {
+        uint64_t lo, hi;
+    } taken[STM_MAX_SECTIONS * 3];
+    size_t n = 0;
+    for (uint64_t i = 0; i < stm->n_sections; i++) {
+        const stm_section_t* s = &stm->sections[i];
+        int copies = (s->flags & STM_DURABLE) ? 3 : 1;
+        for (int c = 0; c < copies; c++) {
+            uint64_t lo = c == 0 ? s->offset : s->shadow[c - 1];
+            // insertion sort by start, there are at most a few dozen
+            size_t j = n++;
+            for (; j > 0 && taken[j - 1].lo > lo; j--)
+                taken[j] = taken[j - 1];
+            taken[j].lo = lo;
+            taken[j].hi = lo + s->size;
+        }
+    }
+    uint64_t at = align_up(sizeof(stm_header_t));
+    for (size_t j = 0; j < n; j++) {
+        if (taken[j].lo >= at + len)
+            return at;
+        if (taken[j].hi > at)
+            at = taken[j].hi;
+    }
+    return at;
+}
+
+void* stm_reserve(const char* name, uint64_t size, unsigned flags) {
+    size = align_up(size ? size : 1);
+    stm_section_t* s = find_section(name);
+    if (s && s->size >= size)
+        return stm_base() + s->offset;
+    if (!s && (stm->n_sections == STM_MAX_SECTIONS || strlen(name) >= STM_NAME_LEN)) {
+        fprintf(stderr, "[agi] stm: cannot add section '%s'\n", name);
+        return NULL;
+    }
+    uint64_t index = s ? (uint64_t)(s - stm->sections) : stm->n_sections;
+    bool durable = s ? (s->flags & STM_DURABLE) != 0 : (flags & STM_DURABLE) != 0;
+    // the commit checksums cover durable sections, so note which commits hold before touching one
+    bool valid[2] = {durable && slot_valid(0), durable && slot_valid(1)};
+
+    // one allocation holds the live copy followed by its shadows, in the first gap it fits
+    uint64_t copies = durable ? 3 : 1;
+    uint64_t len = size * copies;
+    uint64_t off = find_space(len);
+    if (!grow_file(off + len))
+        return NULL;
+    unsigned char* b = stm_base(); // the mapping may have moved
+    // below the high-water mark the gap may hold a moved section's old bytes; above it the file
+    // is still zero from ftruncate, and left untouched
+    if (off < stm->used)
+        memset(b + off, 0, (off + len < stm->used ? off + len : stm->used) - off);
+    if (off + len > stm->used)
+        stm->used = off + len;
+
+    s = &stm->sections[index];
+    if (index < stm->n_sections) {
+        memcpy(b + off, b + s->offset, s->size);
+        if (durable) {
+            memcpy(b + off + size, b + s->shadow[0], s->size);
+            memcpy(b + off + 2 * size, b + s->shadow[1], s->size);
+        }
+    }
+    // the copies are on disk before the header points at them (and frees the old ones), so a
+    // crash leaves one layout or the other whole
+    sync_range(off, len, MS_SYNC);
+    if (index == stm->n_sections) {
+        memset(s, 0, sizeof(*s));
+        strncpy(s->name, name, STM_NAME_LEN - 1);
+        s->flags = flags;
+        stm->n_sections++;
+    }
+    s->offset = off;
+    s->size = size;
+    // the shadows grew, so their digests are stale; the next commits copy the section afresh
+    live_gen[index]++;
+    slot_gen[0][index] = slot_gen[1][index] = 0;
+    digest_ok[0][index] = digest_ok[1][index] = false;
+    if (durable) {
+        s->shadow[0] = off + size;
+        s->shadow[1] = off + 2 * size;
+        // the shadows moved intact (zero-extended), so re-seal exactly the commits that held
+        for (int k = 0; k < 2; k++) {
+            stm_commit_t* c = &stm->commit[k];
+            if (valid[k]) {
+                c->checksum = slot_checksum(k, c->seq);
+            } else {
+                c->seq = 0;
+                c->checksum = 0;
+            }
+        }
+    }
+    msync(stm, stm->file_size, MS_SYNC);
+    if (tuning.lock)
+        lock_sections();
+    return b + off;
+}
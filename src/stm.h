@@ -0,0 +1,116 @@
+/*
+  stm.h - short-term memory arena (persisted in a file via mmap)
+  - one header with a table of named sections, every section 64-byte aligned
+  - a section takes the first gap the others leave (space one moved out of is reused) or the end;
+    the file grows with ftruncate + mremap, never by copying it
+  - durable sections get two shadow copies; a commit copies the live section into the older one
+    and checksums it, so a write torn by a crash can only ever damage the older commit
+  - each commit records the layout (migrate.c) its copy of every section is in, and restoring it
+    restores those stamps, so a crash halfway through upgrading a section never pairs contents
+    with the wrong layout
+  - stm_commit_dirty copies and hashes only the sections marked with stm_dirty since the slot
+    was last written, so a commit costs what changed, not the size of the model
+  - section pointers are invalidated whenever the mapping moves, see stm_remaps
+  - stm_tune asks for huge pages (MADV_HUGEPAGE, or a file on hugetlbfs), locks the live copies
+    of the sections in memory and prefaults the mapping, so the loop does not stall on a major
+    fault; the settings are re-applied whenever the mapping moves or grows
+*/
+#ifndef AGI_STM_H
+#define AGI_STM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STM_ALIGN 64
+#define STM_MAX_SECTIONS 16
+#define STM_NAME_LEN 16
+
+/* section flags */
+#define STM_DURABLE 1u // covered by commits and restored from them on open
+
+typedef struct {
+    char name[STM_NAME_LEN]; // NUL padded
+    uint64_t offset;         // live copy, from the start of the file
+    uint64_t size;           // bytes, a multiple of STM_ALIGN
+    uint64_t shadow[2];      // commit copies of a durable section, 0 otherwise
+    uint64_t flags;
+    uint64_t layout;         // version of the live copy's contents, see migrate.c
+} stm_section_t;
+
+typedef struct {
+    uint64_t seq;      // commit sequence number, newest wins
+    uint64_t checksum; // over seq, and every durable section's layout and shadow copy digest
+    uint64_t layout[STM_MAX_SECTIONS]; // of each durable section's shadow copy, by index
+} stm_commit_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t file_size;
+    uint64_t used; // allocation high-water mark
+    uint64_t seq;  // sequence number of the newest commit
+    uint64_t n_sections;
+    stm_commit_t commit[2];
+    stm_section_t sections[STM_MAX_SECTIONS];
+} stm_header_t;
+
+/* magic & version values to detect layout mismatch */
+#define STM_MAGIC 0xA51A6F257F3C1BULL
+#define STM_VERSION 5
+#define STM_HASH_SEED 0xcbf29ce484222325ULL // the first 'h' of a stm_hash chain
+
+typedef enum {
+    STM_ERROR,   // could not open or map the file
+    STM_FRESH,   // new or unrecognised file, reinitialised with no sections
+    STM_RESUMED, // resumed from the newest valid commit
+} stm_open_t;
+
+typedef enum {
+    STM_HUGE_OFF,
+    STM_HUGE_ADVISE,  // madvise(MADV_HUGEPAGE): transparent huge pages where the filesystem can
+    STM_HUGE_HUGETLB, // stm.dat lives on a hugetlbfs mount (a symlink will do): huge pages always,
+                      // but kept in memory only, so the arena survives exec and not a reboot
+} stm_huge_t;
+
+#define STM_HUGE_COUNT 3
+extern const char* const stm_huge_names[STM_HUGE_COUNT];
+
+typedef struct {
+    int huge;      // stm_huge_t
+    bool lock;     // mlock the live copies of the sections (their shadows are only read on commit)
+    bool prefault; // MAP_POPULATE the mapping, and populate it again whenever it grows
+} stm_tuning_t;
+
+extern stm_header_t* stm;
+/* bumped every time the mapping moves; cached section pointers must be looked up again */
+extern uint64_t stm_remaps;
+
+/* settings for the mapping; before stm_open, or later to change them on the live mapping */
+void stm_tune(const stm_tuning_t* t);
+/* one line on what the settings achieved: page size, bytes in huge pages and locked, and the
+   process's major faults so far */
+void stm_report(char* out, size_t len);
+stm_open_t stm_open(const char* path);
+void stm_close(void);
+/* live copy of a section, NULL if there is none; 'size' may be NULL */
+void* stm_section(const char* name, uint64_t* size);
+/* look up a section, creating or growing it to at least 'size' bytes (contents are preserved,
+   new bytes are zero). may move the mapping */
+void* stm_reserve(const char* name, uint64_t size, unsigned flags);
+/* layout version of a section's contents, 0 for a missing section */
+uint64_t stm_layout(const char* name);
+void stm_set_layout(const char* name, uint64_t layout);
+/* note that the live copy of the section holding 'live' has been written */
+void stm_dirty(const void* live);
+/* copy every durable section into the older commit slot and msync it with 'flags' */
+void stm_commit(int flags);
+/* the same, copying only what stm_dirty marked since the slot was last written */
+void stm_commit_dirty(int flags);
+/* remap the arena copy-on-write in place (for a forked evaluator): the file keeps the state as of
+   the call, later writes stay in this process, and commits and growth become no-ops/failures */
+bool stm_make_private(void);
+
+uint64_t stm_hash(uint64_t h, const void* data, size_t len);
+
+#endif
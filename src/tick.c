@@ -0,0 +1,61 @@
+#define _GNU_SOURCE
+#include "tick.h"
+
+#include <errno.h>
+
+const char* const tick_mode_names[TICK_MODE_COUNT] = {"free", "fixed", "adaptive"};
+
+#define NSEC_PER_SEC 1000000000LL
+
+static int64_t ts_to_ns(const struct timespec* ts) {
+    return (int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static struct timespec ns_to_ts(int64_t ns) {
+    struct timespec ts = {(time_t)(ns / NSEC_PER_SEC), (long)(ns % NSEC_PER_SEC)};
+    return ts;
+}
+
+void tick_init(tick_t* t, int mode, double hz) {
+    t->mode = mode;
+    t->period_ns = hz > 0 ? (int64_t)((double)NSEC_PER_SEC / hz) : 0;
+    if (t->period_ns <= 0)
+        t->mode = TICK_FREE;
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+    t->deadline = t->start;
+    t->ticks = 0;
+    t->overruns = 0;
+}
+
+void tick_wait(tick_t* t) {
+    t->ticks++;
+    if (t->mode == TICK_FREE)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_ns = ts_to_ns(&now);
+
+    if (t->mode == TICK_FIXED) {
+        int64_t deadline = ts_to_ns(&t->deadline) + t->period_ns;
+        if (deadline <= now_ns) {
+            // overran: skip the grid points we missed rather than bursting to catch up
+            t->overruns++;
+            deadline += ((now_ns - deadline) / t->period_ns + 1) * t->period_ns;
+        }
+        t->deadline = ns_to_ts(deadline);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t->deadline, NULL) == EINTR) {
+        }
+        return;
+    }
+
+    // adaptive: the budget restarts at the end of every sleep
+    int64_t left = t->period_ns - (now_ns - ts_to_ns(&t->start));
+    if (left > 0) {
+        struct timespec rel = ns_to_ts(left);
+        nanosleep(&rel, NULL);
+    } else {
+        t->overruns++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
@@ -0,0 +1,31 @@
+/*
+  tick.h - loop pacing for the learner
+  - free: no sleep at all, run as fast as the loop body allows
+  - fixed: absolute deadlines on a CLOCK_MONOTONIC grid, so body time never accumulates drift
+  - adaptive: sleep whatever is left of the period after the body ran
+*/
+#ifndef AGI_TICK_H
+#define AGI_TICK_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef enum { TICK_FREE, TICK_FIXED, TICK_ADAPTIVE } tick_mode_t;
+
+#define TICK_MODE_COUNT 3
+extern const char* const tick_mode_names[TICK_MODE_COUNT];
+
+typedef struct {
+    int mode;
+    int64_t period_ns;
+    struct timespec deadline; // next absolute deadline (fixed)
+    struct timespec start;    // when the current tick began (adaptive)
+    uint64_t ticks;
+    uint64_t overruns; // ticks whose body did not fit in the period
+} tick_t;
+
+void tick_init(tick_t* t, int mode, double hz);
+/* call once at the end of every loop iteration */
+void tick_wait(tick_t* t);
+
+#endif
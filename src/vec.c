@@ -0,0 +1,146 @@
+#include "vec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VEC_X86 1
+#include <immintrin.h>
+#endif
+
+/* --- portable fallback --- */
+static double dot_scalar(const double* a, const double* b, size_t n) {
+    double s = 0.0;
+    for (size_t i = 0; i < n; i++)
+        s += a[i] * b[i];
+    return s;
+}
+
+static void axpy_scalar(double alpha, const double* x, double* y, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] += alpha * x[i];
+}
+
+static const vec_ops_t ops_scalar = {"scalar", dot_scalar, axpy_scalar};
+
+#ifdef VEC_X86
+/* --- sse2: two lanes, two accumulators --- */
+__attribute__((target("sse2"))) static double dot_sse2(const double* a, const double* b,
+                                                       size_t n) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    s0 = _mm_add_pd(s0, s1);
+    double s = _mm_cvtsd_f64(_mm_add_sd(s0, _mm_unpackhi_pd(s0, s0)));
+    for (; i < n; i++)
+        s += a[i] * b[i];
+    return s;
+}
+
+__attribute__((target("sse2"))) static void axpy_sse2(double alpha, const double* x, double* y,
+                                                      size_t n) {
+    __m128d va = _mm_set1_pd(alpha);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(va, _mm_loadu_pd(x + i))));
+    for (; i < n; i++)
+        y[i] += alpha * x[i];
+}
+
+static const vec_ops_t ops_sse2 = {"sse2", dot_sse2, axpy_sse2};
+
+/* --- avx2+fma: four lanes, four accumulators to hide fma latency. every kernel ends with an
+   explicit vzeroupper: gcc only inserts one when optimising, and at -O0 the dirty upper halves
+   made the sse code in libm (cos in the features) over ten times slower --- */
+__attribute__((target("avx2,fma"))) static double dot_avx2(const double* a, const double* b,
+                                                           size_t n) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), s0);
+        s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), s1);
+        s2 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 8), _mm256_loadu_pd(b + i + 8), s2);
+        s3 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 12), _mm256_loadu_pd(b + i + 12), s3);
+    }
+    for (; i + 4 <= n; i += 4)
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), s0);
+    __m256d s = _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3));
+    __m128d h = _mm_add_pd(_mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1));
+    double r = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+    for (; i < n; i++)
+        r += a[i] * b[i];
+    _mm256_zeroupper();
+    return r;
+}
+
+__attribute__((target("avx2,fma"))) static void axpy_avx2(double alpha, const double* x,
+                                                          double* y, size_t n) {
+    __m256d va = _mm256_set1_pd(alpha);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d y0 = _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i));
+        __m256d y1 = _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4));
+        _mm256_storeu_pd(y + i, y0);
+        _mm256_storeu_pd(y + i + 4, y1);
+    }
+    for (; i < n; i++)
+        y[i] += alpha * x[i];
+    _mm256_zeroupper();
+}
+
+static const vec_ops_t ops_avx2 = {"avx2", dot_avx2, axpy_avx2};
+#endif
+
+const vec_ops_t* vec = &ops_scalar;
+
+static bool vec_supported(const vec_ops_t* ops) {
+#ifdef VEC_X86
+    __builtin_cpu_init();
+    if (ops == &ops_avx2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (ops == &ops_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return ops == &ops_scalar;
+}
+
+bool vec_select(const char* name) {
+    static const vec_ops_t* const all[] = {
+#ifdef VEC_X86
+            &ops_avx2,
+            &ops_sse2,
+#endif
+            &ops_scalar,
+    };
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (strcmp(all[i]->name, name) == 0 && vec_supported(all[i])) {
+            vec = all[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool vec_has_avx2(void) {
+#ifdef VEC_X86
+    return vec == &ops_avx2;
+#else
+    return false;
+#endif
+}
+
+void vec_init(void) {
+    const char* forced = getenv("AGI_VEC");
+    if (forced && vec_select(forced))
+        return;
+    if (forced)
+        fprintf(stderr, "[agi] AGI_VEC=%s not available, autodetecting\n", forced);
+    if (vec_select("avx2") || vec_select("sse2"))
+        return;
+    vec_select("scalar");
+}
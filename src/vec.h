@@ -0,0 +1,28 @@
+/*
+  vec.h - dense double-precision kernels for the learner
+  - one implementation per instruction set (avx2+fma, sse2, scalar)
+  - vec_init() picks the best one the cpu supports at runtime (cpuid), AGI_VEC=name forces one
+*/
+#ifndef AGI_VEC_H
+#define AGI_VEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    const char* name;
+    double (*dot)(const double* a, const double* b, size_t n);
+    void (*axpy)(double alpha, const double* x, double* y, size_t n); // y += alpha * x
+} vec_ops_t;
+
+/* the selected kernels; valid after vec_init() */
+extern const vec_ops_t* vec;
+
+void vec_init(void);
+/* force a kernel set by name, false if unknown or unsupported on this cpu */
+bool vec_select(const char* name);
+/* whether the avx2+fma set was selected. the avx2 kernels elsewhere (env, rng, gemm) follow it,
+   so AGI_VEC governs them too, and end with _mm256_zeroupper() like the ones in vec.c */
+bool vec_has_avx2(void);
+
+#endif
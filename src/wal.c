@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+#include "wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stm.h"
+
+#define WAL_HASH_SEED 0xcbf29ce484222325ULL
+
+const char* const wal_kind_names[WAL_KIND_COUNT] = {"full", "dense", "sparse", "checkpoint"};
+
+static struct {
+    char path[4096];
+    int fd;
+    uint64_t end;       // logical end of the log, the buffer included
+    unsigned char* buf; // WAL_BUFFER bytes
+    size_t used;
+    // the state the log implies: the last full record plus every change since
+    double* image;
+    size_t image_n;
+    double image_bias;
+    bool have_image;
+    unsigned char* payload; // scratch for one record's payload
+    size_t cap;             // parameters image and payload have room for
+    uint64_t remaps;
+    stm_wal_t* section;
+} wal = {.fd = -1, .remaps = UINT64_MAX};
+
+static stm_wal_t* section(void) {
+    if (wal.remaps != stm_remaps) {
+        wal.remaps = stm_remaps;
+        wal.section = stm_section("wal", NULL);
+    }
+    return wal.section;
+}
+
+static size_t payload_size(uint32_t kind, uint32_t n) {
+    switch (kind) {
+        case WAL_FULL:
+        case WAL_DENSE:
+            return (size_t)n * sizeof(double);
+        case WAL_SPARSE:
+            return (size_t)n * sizeof(double) + (((size_t)n * sizeof(uint32_t) + 7) & ~(size_t)7);
+        default:
+            return 0;
+    }
+}
+
+static uint64_t record_check(const wal_record_t* h, const void* payload, size_t len) {
+    wal_record_t c = *h;
+    c.check = 0;
+    return stm_hash(stm_hash(WAL_HASH_SEED, &c, sizeof(c)), payload, len);
+}
+
+static bool write_all(int fd, const void* p, size_t len) {
+    const unsigned char* b = p;
+    while (len > 0) {
+        ssize_t w = write(fd, b, len);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            perror("write(wal)");
+            return false;
+        }
+        b += w;
+        len -= (size_t)w;
+    }
+    return true;
+}
+
+static bool reserve(size_t params) {
+    if (params <= wal.cap)
+        return true;
+    double* image = realloc(wal.image, params * sizeof(double));
+    if (image)
+        wal.image = image;
+    // the largest payload: a sparse record of every parameter
+    size_t largest = params * (sizeof(double) + sizeof(uint32_t)) + 8;
+    unsigned char* payload = realloc(wal.payload, largest);
+    if (payload)
+        wal.payload = payload;
+    if (!image || !payload) {
+        perror("realloc(wal)");
+        return false;
+    }
+    wal.cap = params;
+    return true;
+}
+
+bool wal_flush(bool sync) {
+    if (wal.fd < 0)
+        return true;
+    bool ok = write_all(wal.fd, wal.buf, wal.used);
+    wal.used = 0;
+    if (ok && sync && fdatasync(wal.fd) != 0) {
+        perror("fdatasync(wal)");
+        ok = false;
+    }
+    return ok;
+}
+
+/* append one record, and advance the section with it: the live state now contains it */
+static void emit(wal_record_t* h, const void* payload, size_t len) {
+    stm_wal_t* s = section();
+    h->magic = WAL_MAGIC;
+    h->lsn = s->lsn + 1;
+    h->check = record_check(h, payload, len);
+    size_t total = sizeof(*h) + len;
+    if (wal.used + total > WAL_BUFFER)
+        wal_flush(false);
+    if (total > WAL_BUFFER) {
+        // larger than the whole buffer (a full record of a big mlp): straight to the file
+        write_all(wal.fd, h, sizeof(*h));
+        write_all(wal.fd, payload, len);
+    } else {
+        memcpy(wal.buf + wal.used, h, sizeof(*h));
+        memcpy(wal.buf + wal.used + sizeof(*h), payload, len);
+        wal.used += total;
+    }
+    wal.end += total;
+    s->lsn = h->lsn;
+    s->offset = wal.end;
+}
+
+void wal_append(uint64_t iter, double reward, double* weights, size_t params, stm_core_t* core) {
+    if (wal.fd < 0 || !section() || params > UINT32_MAX || !reserve(params))
+        return;
+    wal_record_t h = {0};
+    h.iter = iter;
+    h.params = (uint32_t)params;
+    h.reward = reward;
+    h.running_reward = core->running_reward;
+    double* change = (double*)wal.payload;
+    if (!wal.have_image || wal.image_n != params) {
+        memcpy(wal.image, weights, params * sizeof(double));
+        wal.image_n = params;
+        wal.image_bias = core->bias;
+        wal.have_image = true;
+        h.kind = WAL_FULL;
+        h.n = (uint32_t)params;
+        h.bias = core->bias;
+        emit(&h, wal.image, payload_size(h.kind, h.n));
+        return;
+    }
+    size_t nnz = 0;
+    for (size_t i = 0; i < params; i++) {
+        double d = weights[i] - wal.image[i];
+        change[i] = d;
+        if (d != 0.0) {
+            nnz++;
+            wal.image[i] += d;
+            // the sum can round away from the live value; nudge that onto what a replay computes
+            if (wal.image[i] != weights[i])
+                weights[i] = wal.image[i];
+        }
+    }
+    h.bias = core->bias - wal.image_bias;
+    wal.image_bias += h.bias;
+    if (wal.image_bias != core->bias)
+        core->bias = wal.image_bias;
+    // (index, change) pairs cost 12 bytes to a dense change's 8
+    if (nnz * 3 < params * 2) {
+        // the indices collect past the dense changes, which are still being read, then move down
+        uint32_t* index = (uint32_t*)(wal.payload + params * sizeof(double));
+        size_t k = 0;
+        for (size_t i = 0; i < params; i++) {
+            if (change[i] != 0.0) {
+                change[k] = change[i];
+                index[k++] = (uint32_t)i;
+            }
+        }
+        // no stale bytes in the padding, the check covers it
+        index[nnz] = 0;
+        memmove(wal.payload + nnz * sizeof(double), index, (nnz + 1) * sizeof(uint32_t));
+        h.kind = WAL_SPARSE;
+        h.n = (uint32_t)nnz;
+    } else {
+        h.kind = WAL_DENSE;
+        h.n = (uint32_t)params;
+    }
+    emit(&h, wal.payload, payload_size(h.kind, h.n));
+}
+
+bool wal_rotate(void) {
+    stm_wal_t* s = section();
+    if (wal.fd < 0 || !s || wal.end < WAL_ROTATE_BYTES)
+        return true;
+    if (!wal_flush(true))
+        return false;
+    char old[sizeof(wal.path) + 2];
+    snprintf(old, sizeof(old), "%s.1", wal.path);
+    if (rename(wal.path, old) != 0) {
+        perror("rename(wal)");
+        return false;
+    }
+    int fd = open(wal.path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("open(wal)");
+        rename(old, wal.path);
+        return false;
+    }
+    close(wal.fd);
+    wal.fd = fd;
+    wal.end = 0;
+    s->offset = 0;
+    return true;
+}
+
+void wal_checkpoint(uint64_t iter) {
+    if (wal.fd < 0 || !section())
+        return;
+    wal_record_t h = {0};
+    h.kind = WAL_CHECKPOINT;
+    h.iter = iter;
+    emit(&h, NULL, 0);
+}
+
+/* the record at 'off' if it is whole (within 'size') and valid with sequence number 'lsn'
+   (0 = any), its payload in wal.payload. 'params_max' bounds the parameter count */
+static bool read_record(int fd, uint64_t off, uint64_t size, uint64_t lsn, uint64_t params_max,
+                        wal_record_t* h) {
+    if (pread(fd, h, sizeof(*h), (off_t)off) != (ssize_t)sizeof(*h) || h->magic != WAL_MAGIC ||
+        h->kind >= WAL_KIND_COUNT || (lsn && h->lsn != lsn) || h->params > params_max)
+        return false;
+    if ((h->kind == WAL_FULL || h->kind == WAL_DENSE) && h->n != h->params)
+        return false;
+    if ((h->kind == WAL_SPARSE && h->n > h->params) || (h->kind == WAL_CHECKPOINT && h->n))
+        return false;
+    size_t len = payload_size(h->kind, h->n);
+    if (off + sizeof(*h) + len > size || !reserve(h->params))
+        return false;
+    if (len && pread(fd, wal.payload, len, (off_t)(off + sizeof(*h))) != (ssize_t)len)
+        return false;
+    return record_check(h, wal.payload, len) == h->check;
+}
+
+static void apply(const wal_record_t* h, double* weights, stm_core_t* core) {
+    const double* change = (const double*)wal.payload;
+    switch (h->kind) {
+        case WAL_FULL:
+            memcpy(weights, change, (size_t)h->n * sizeof(double));
+            core->bias = h->bias;
+            break;
+        case WAL_DENSE:
+            for (size_t i = 0; i < h->n; i++)
+                weights[i] += change[i];
+            core->bias += h->bias;
+            break;
+        case WAL_SPARSE: {
+            const uint32_t* index = (const uint32_t*)(wal.payload + h->n * sizeof(double));
+            for (size_t k = 0; k < h->n; k++) {
+                if (index[k] < h->params)
+                    weights[index[k]] += change[k];
+            }
+            core->bias += h->bias;
+            break;
+        }
+        default:
+            return;
+    }
+    core->running_reward = h->running_reward;
+    if (core->iter <= h->iter)
+        core->iter = h->iter + 1;
+}
+
+/* apply the records of 'fd' (of 'size' bytes) that continue the section's, advancing it */
+static long replay(int fd, uint64_t size, uint64_t cap, double* weights, stm_core_t* core) {
+    stm_wal_t* s = section();
+    wal_record_t h;
+    long n = 0;
+    while (read_record(fd, s->offset, size, s->lsn + 1, cap, &h)) {
+        apply(&h, weights, core);
+        s->lsn = h.lsn;
+        s->offset += sizeof(h) + payload_size(h.kind, h.n);
+        n++;
+    }
+    return n;
+}
+
+long wal_open(const char* path, bool append, double* weights, uint64_t cap, stm_core_t* core) {
+    wal_close();
+    stm_wal_t* s = section();
+    if (!s) {
+        fprintf(stderr, "[agi] wal: no section to track the log in\n");
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_CLOEXEC | (append ? O_CREAT : 0), 0644);
+    if (fd < 0) {
+        if (!append && errno == ENOENT)
+            return 0;
+        perror("open(wal)");
+        return -1;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        perror("fstat(wal)");
+        close(fd);
+        return -1;
+    }
+    uint64_t size = (uint64_t)sb.st_size;
+    long replayed = 0;
+    if (s->lsn == 0) {
+        // a new arena: whatever is in the log belongs to an old one, continue after it
+        s->offset = size;
+    } else {
+        replayed = replay(fd, size, cap, weights, core);
+        char old[sizeof(wal.path) + 2];
+        snprintf(old, sizeof(old), "%s.1", path);
+        int ofd = replayed ? -1 : open(old, O_RDONLY | O_CLOEXEC);
+        if (ofd >= 0) {
+            // the commit may predate the last rotation: then the records go on in the old log
+            // and from there at the start of this one
+            if (fstat(ofd, &sb) == 0 && (replayed = replay(ofd, (uint64_t)sb.st_size, cap,
+                                                           weights, core)) > 0) {
+                s->offset = 0;
+                replayed += replay(fd, size, cap, weights, core);
+            }
+            close(ofd);
+        }
+    }
+    // cut a torn tail, or pad over records a crash lost whose effect the commit already has
+    if (size != s->offset && ftruncate(fd, (off_t)s->offset) != 0) {
+        perror("ftruncate(wal)");
+        close(fd);
+        return -1;
+    }
+    if (!append) {
+        close(fd);
+        return replayed;
+    }
+    wal.buf = malloc(WAL_BUFFER);
+    if (!wal.buf || lseek(fd, (off_t)s->offset, SEEK_SET) < 0) {
+        perror("wal_open");
+        free(wal.buf);
+        wal.buf = NULL;
+        close(fd);
+        return -1;
+    }
+    snprintf(wal.path, sizeof(wal.path), "%s", path);
+    wal.fd = fd;
+    wal.end = s->offset;
+    wal.used = 0;
+    wal.have_image = false;
+    return replayed;
+}
+
+void wal_close(void) {
+    if (wal.fd < 0)
+        return;
+    wal_flush(true);
+    close(wal.fd);
+    wal.fd = -1;
+    free(wal.buf);
+    wal.buf = NULL;
+}
+
+bool wal_is_open(void) {
+    return wal.fd >= 0;
+}
+
+void wal_resync(void) {
+    wal.have_image = false;
+}
+
+bool wal_decode(const char* path, FILE* out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+    uint64_t size = (uint64_t)sb.st_size;
+    fprintf(out, "lsn,iter,kind,reward,running_reward,params,entries,bias,change_norm\n");
+    uint64_t off = 0, skipped = 0;
+    wal_record_t h;
+    while (off + sizeof(h) <= size) {
+        // holes (records a crash lost) and torn records are stepped over a word at a time
+        if (!read_record(fd, off, size, 0, UINT32_MAX, &h)) {
+            off += 8;
+            skipped += 8;
+            continue;
+        }
+        if (skipped) {
+            fprintf(stderr, "[agi] wal: %lu bytes skipped before offset %lu\n", skipped, off);
+            skipped = 0;
+        }
+        const double* change = (const double*)wal.payload;
+        double norm = 0.0;
+        if (h.kind == WAL_DENSE || h.kind == WAL_SPARSE) {
+            for (size_t i = 0; i < h.n; i++)
+                norm += change[i] * change[i];
+        }
+        fprintf(out, "%lu,%lu,%s,%.9g,%.9g,%u,%u,%.9g,%.9g\n", h.lsn, h.iter,
+                wal_kind_names[h.kind], h.reward, h.running_reward, h.params, h.n, h.bias,
+                sqrt(norm));
+        off += sizeof(h) + payload_size(h.kind, h.n);
+    }
+    close(fd);
+    return true;
+}
@@ -0,0 +1,82 @@
+/*
+  wal.h - append-only write-ahead log of the learner's updates (SYNC_MODE=wal)
+  - every iteration of the loop appends one compact record: its iter, reward and running_reward
+    and the change it made to the parameters and bias, dense or as (index, change) pairs,
+    whichever is smaller. the first record after opening, after the parameter count changed and
+    after wal_resync hold the absolute values instead
+  - records go through a large buffer and reach the file as sequential writes; SYNC_INTERVAL
+    iterations are flushed together, and a checkpoint (a full MS_SYNC commit of the arena) only
+    happens every CHECKPOINT_INTERVAL iterations
+  - the "wal" section (state.h, reserved with the others) notes the last record the live state
+    contains, and a commit carries that along. recovery starts from the newest commit and
+    replays the valid records after it; a torn tail is cut off
+  - changes are taken against the state the log itself implies, and where adding a change
+    rounds away from the live value (an ulp now and then) the live value is nudged onto it, so a
+    replay reproduces the state bit for bit. hogwild workers' updates reach the log through the
+    loop's next record
+  - the optimizer moments are not logged: after a crash they are those of the last checkpoint
+  - the log is the run's training history, kept past the checkpoints: --decode-wal=stm.wal
+    prints it. once it is WAL_ROTATE_BYTES long, the next checkpoint moves it to stm.wal.1
+    (replacing the one before) and starts a new one
+*/
+#ifndef AGI_WAL_H
+#define AGI_WAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "state.h"
+
+#define WAL_PATH "stm.wal"
+#define WAL_BUFFER (1u << 20) // bytes collected before a write
+#define WAL_MAGIC 0x4c4157u   // "WAL"
+#define WAL_ROTATE_BYTES (1ull << 30)
+
+typedef enum {
+    WAL_FULL,       // absolute parameters and bias
+    WAL_DENSE,      // a change for every parameter
+    WAL_SPARSE,     // n changes, then their n parameter indices (uint32, padded to 8 bytes)
+    WAL_CHECKPOINT, // the arena was committed here; no payload
+} wal_kind_t;
+
+#define WAL_KIND_COUNT 4
+extern const char* const wal_kind_names[WAL_KIND_COUNT];
+
+/* 64 bytes, followed by the payload its kind describes */
+typedef struct {
+    uint32_t magic;
+    uint32_t kind;
+    uint64_t lsn; // 1, 2, ... over the life of the log
+    uint64_t iter;
+    uint32_t params; // parameters in use
+    uint32_t n;      // payload entries
+    double reward;
+    double running_reward;
+    double bias;     // absolute in a full record, else the change
+    uint64_t check;  // stm_hash of the header (this field zero) and the payload
+} wal_record_t;
+
+/* replay the records of 'path' the newest commit does not contain yet onto 'weights' (room for
+   'cap' doubles) and 'core', then, with 'append', keep the log open for wal_append. returns the
+   records replayed, -1 if the log cannot be opened */
+long wal_open(const char* path, bool append, double* weights, uint64_t cap, stm_core_t* core);
+void wal_close(void);
+bool wal_is_open(void);
+/* log the loop's iteration 'iter': the first 'params' entries of 'weights' and core's bias and
+   running_reward as they are now (nudged as above) */
+void wal_append(uint64_t iter, double reward, double* weights, size_t params, stm_core_t* core);
+/* the parameters were replaced outside the log (a restored snapshot, a fresh model): the next
+   record holds them whole, a change against the log's image would replay onto the wrong base */
+void wal_resync(void);
+/* at a checkpoint, before the commit: start a new log if this one has grown too long */
+bool wal_rotate(void);
+/* note a checkpoint at 'iter' (after the commit) */
+void wal_checkpoint(uint64_t iter);
+/* write out the buffer, and fdatasync it with 'sync' */
+bool wal_flush(bool sync);
+/* print a log one record per line, for offline analysis */
+bool wal_decode(const char* path, FILE* out);
+
+#endif
@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include "watch.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+#define WATCH_FD_ENV "AGI_WATCH_FD"
+
+static int watch_fd = -1;
+static char watch_path[4096];
+static const char* watch_name = NULL; // basename inside watch_path
+
+static void* watch_thread(void* arg) {
+    // room for at least one event with the longest name
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(watch_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            perror("[agi] read(inotify)");
+            return NULL;
+        }
+        bool ours = false;
+        for (char* p = buf; p < buf + n;) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            if (ev->len && strcmp(ev->name, watch_name) == 0)
+                ours = true;
+            p += sizeof(*ev) + ev->len;
+        }
+        // a no-op when the change was our own mutation, which already compiled it
+        if (ours)
+            config_refresh(watch_path);
+    }
+}
+
+/* the instance an exec'ing parent left open for us, -1 if there is none */
+static int inherited_fd(void) {
+    const char* v = getenv(WATCH_FD_ENV);
+    if (!v)
+        return -1;
+    int fd = atoi(v);
+    unsetenv(WATCH_FD_ENV);
+    char link[64], target[64];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t n = readlink(link, target, sizeof(target) - 1);
+    if (n < 0)
+        return -1;
+    target[n] = '\0';
+    if (strcmp(target, "anon_inode:inotify") != 0)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+void watch_adopt(void) {
+    watch_fd = inherited_fd();
+}
+
+void watch_drop(void) {
+    if (watch_fd < 0)
+        return;
+    close(watch_fd);
+    watch_fd = -1;
+}
+
+void watch_handoff(void) {
+    if (watch_fd < 0 || fcntl(watch_fd, F_SETFD, 0) != 0)
+        return;
+    char v[16];
+    snprintf(v, sizeof(v), "%d", watch_fd);
+    setenv(WATCH_FD_ENV, v, 1);
+}
+
+void watch_reclaim(void) {
+    if (watch_fd < 0)
+        return;
+    fcntl(watch_fd, F_SETFD, FD_CLOEXEC);
+    unsetenv(WATCH_FD_ENV);
+}
+
+bool watch_config(const char* selfpath) {
+    snprintf(watch_path, sizeof(watch_path), "%s", selfpath);
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s", selfpath);
+    char* slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+        watch_name = watch_path + (slash - dir) + 1;
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+        watch_name = watch_path;
+    }
+    if (dir[0] == '\0')
+        snprintf(dir, sizeof(dir), "/");
+
+    if (watch_fd < 0)
+        watch_fd = inotify_init1(IN_CLOEXEC);
+    if (watch_fd < 0) {
+        perror("[agi] inotify_init1");
+        return false;
+    }
+    if (inotify_add_watch(watch_fd, dir, WATCH_EVENTS) < 0) {
+        perror("[agi] inotify_add_watch");
+        close(watch_fd);
+        watch_fd = -1;
+        return false;
+    }
+    pthread_t t;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&t, &attr, watch_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "[agi] pthread_create(watcher): %s\n", strerror(err));
+        close(watch_fd);
+        watch_fd = -1;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+/*
+  watch.h - live config reload: a background thread blocked on inotify
+  - watches the directory of the source (editors and write_source_config replace it by rename,
+    which a watch on the file itself would lose) and recompiles the sidecar when it changes
+  - the parse happens on the watcher thread; the loop sees the new sidecar generation with the
+    single load it already does every iteration, so a live retune costs it nothing
+  - config.bin needs no watch of its own: it is a shared mapping, so a write by any process is
+    visible immediately
+  - the inotify instance is handed across a self-exec rather than closed: closing one waits out
+    an RCU grace period, some 15 ms the new generation would spend before reaching main
+*/
+#ifndef AGI_WATCH_H
+#define AGI_WATCH_H
+
+#include <stdbool.h>
+
+/* take over the instance the previous generation handed across the exec, if any: the variable
+   is consumed and the fd marked close-on-exec at once, so nothing this process starts inherits
+   it. call first thing in main */
+void watch_adopt(void);
+/* close an adopted instance that watch_config will not be using */
+void watch_drop(void);
+/* start watching 'selfpath' (on the adopted instance, if there is one), false if inotify or the thread is unavailable (the caller then keeps
+   polling with config_refresh) */
+bool watch_config(const char* selfpath);
+/* keep the instance open across the coming exec, for the next generation's watch_config */
+void watch_handoff(void);
+/* undo watch_handoff after the exec failed, so nothing else the process runs inherits it */
+void watch_reclaim(void);
+
+#endif